@@ -0,0 +1,225 @@
+#include "block_io.hpp"
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+static const unsigned RING_ENTRIES = 64;
+// Well below IOV_MAX (1024) so one segment never has to be split by the kernel.
+static const int MAX_IOV_PER_SEGMENT = 256;
+
+// Submission and completion rings shared with the kernel (set up with raw syscalls, so
+// liburing is not needed).
+struct BlockIO::Ring {
+    void* sq_ptr = MAP_FAILED;
+    size_t sq_len = 0;
+    void* cq_ptr = MAP_FAILED;
+    size_t cq_len = 0;
+    io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    size_t sqes_len = 0;
+    unsigned* sq_tail = nullptr;
+    unsigned* sq_mask = nullptr;
+    unsigned* sq_array = nullptr;
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned* cq_mask = nullptr;
+    io_uring_cqe* cqes = nullptr;
+    unsigned entries = 0;
+
+    ~Ring() {
+        if (sqes != MAP_FAILED) munmap(sqes, sqes_len);
+        if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr) munmap(cq_ptr, cq_len);
+        if (sq_ptr != MAP_FAILED) munmap(sq_ptr, sq_len);
+    }
+};
+
+static int uring_enter(int ring_fd, unsigned to_submit, unsigned min_complete) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, IORING_ENTER_GETEVENTS, nullptr, 0));
+}
+
+bool BlockIO::setup_ring(unsigned entries) {
+    io_uring_params p;
+    std::memset(&p, 0, sizeof(p));
+    int rfd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &p));
+    if (rfd < 0) return false;
+    Ring* r = new Ring();
+    r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single) r->sq_len = r->cq_len = std::max(r->sq_len, r->cq_len);
+    r->sq_ptr = mmap(nullptr, r->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, rfd, IORING_OFF_SQ_RING);
+    if (r->sq_ptr != MAP_FAILED)
+        r->cq_ptr = single ? r->sq_ptr : mmap(nullptr, r->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, rfd, IORING_OFF_CQ_RING);
+    r->sqes_len = p.sq_entries * sizeof(io_uring_sqe);
+    if (r->cq_ptr != MAP_FAILED)
+        r->sqes = static_cast<io_uring_sqe*>(mmap(nullptr, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, rfd, IORING_OFF_SQES));
+    if (r->sqes == MAP_FAILED) { delete r; ::close(rfd); return false; }
+    char* sq = static_cast<char*>(r->sq_ptr);
+    char* cq = static_cast<char*>(r->cq_ptr);
+    r->sq_tail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+    r->sq_mask = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+    r->sq_array = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+    r->cq_head = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+    r->cq_tail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+    r->cq_mask = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+    r->cqes = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+    r->entries = p.sq_entries;
+    ring = r;
+    ring_fd = rfd;
+    return true;
+}
+
+bool BlockIO::open(const char* path, bool want_uring) {
+    close();
+    fd = ::open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0) return false;
+    if (want_uring) setup_ring(RING_ENTRIES);
+    return true;
+}
+
+void BlockIO::close() {
+    delete ring;
+    ring = nullptr;
+    if (ring_fd >= 0) ::close(ring_fd);
+    ring_fd = -1;
+    if (fd >= 0) ::close(fd);
+    fd = -1;
+    ops.clear();
+}
+
+void BlockIO::queue(bool write, uint64_t off, void* buf, size_t len) {
+    if (len == 0) return;
+    ops.push_back(Op{write, barrier_next, off, iovec{buf, len}});
+    barrier_next = false;
+}
+
+void BlockIO::build_segments() {
+    segments.clear();
+    iovs.clear();
+    for (const Op& op : ops) {
+        if (!segments.empty()) {
+            Segment& s = segments.back();
+            if (s.write == op.write && !op.barrier && s.off + s.len == op.off && s.iov_count < MAX_IOV_PER_SEGMENT) {
+                iovs.push_back(op.iov);
+                s.iov_count++;
+                s.len += op.iov.iov_len;
+                continue;
+            }
+        }
+        segments.push_back(Segment{op.write, op.barrier, op.off, iovs.size(), 1, op.iov.iov_len});
+        iovs.push_back(op.iov);
+    }
+}
+
+// Performs a segment with preadv/pwritev, skipping the first `done` bytes (already
+// transferred by a short io_uring completion).
+bool BlockIO::run_sync(const Segment& s, size_t done) {
+    iovec local[MAX_IOV_PER_SEGMENT];
+    while (done < s.len) {
+        int cnt = 0;
+        size_t skip = done;
+        for (int i = 0; i < s.iov_count; ++i) {
+            const iovec& v = iovs[s.first_iov + i];
+            if (skip >= v.iov_len) { skip -= v.iov_len; continue; }
+            local[cnt].iov_base = static_cast<char*>(v.iov_base) + skip;
+            local[cnt].iov_len = v.iov_len - skip;
+            skip = 0;
+            ++cnt;
+        }
+        off_t at = static_cast<off_t>(s.off + done);
+        ssize_t n = s.write ? pwritev(fd, local, cnt, at) : preadv(fd, local, cnt, at);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// Waits for count completions, finishing short transfers synchronously. False if the
+// kernel could not be waited on, in which case requests may still be in flight.
+bool BlockIO::reap(unsigned count, bool& ok) {
+    unsigned reaped = 0;
+    while (reaped < count) {
+        unsigned head = *ring->cq_head;
+        if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+            if (uring_enter(ring_fd, 0, 1) < 0 && errno != EINTR) return false;
+            continue;
+        }
+        const io_uring_cqe& cqe = ring->cqes[head & *ring->cq_mask];
+        const Segment& s = segments[cqe.user_data];
+        if (cqe.res < 0) ok = false;
+        else if (static_cast<size_t>(cqe.res) < s.len) ok = run_sync(s, static_cast<size_t>(cqe.res)) && ok;
+        __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+        ++reaped;
+    }
+    return true;
+}
+
+// Submits segments in windows of at most ring->entries and waits for each window. A
+// barrier starts a new window, so everything before it has completed first.
+bool BlockIO::run_uring() {
+    bool ok = true;
+    size_t next = 0;
+    while (next < segments.size()) {
+        unsigned tail = *ring->sq_tail;
+        unsigned n = 0;
+        while (next < segments.size() && n < ring->entries && (n == 0 || !segments[next].barrier)) {
+            const Segment& s = segments[next];
+            unsigned idx = tail & *ring->sq_mask;
+            io_uring_sqe* sqe = &ring->sqes[idx];
+            std::memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = s.write ? IORING_OP_WRITEV : IORING_OP_READV;
+            sqe->fd = fd;
+            sqe->addr = reinterpret_cast<uint64_t>(&iovs[s.first_iov]);
+            sqe->len = static_cast<uint32_t>(s.iov_count);
+            sqe->off = s.off;
+            sqe->user_data = next;
+            ring->sq_array[idx] = idx;
+            ++tail;
+            ++n;
+            ++next;
+        }
+        __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+        unsigned submitted = 0;
+        while (submitted < n) {
+            int r = uring_enter(ring_fd, n - submitted, n - submitted);
+            if (r < 0 && errno == EINTR) continue;
+            if (r <= 0) {
+                // The ring is unusable. Entries the kernel already took are still running
+                // against our buffers, so wait for them before dropping the ring (the kernel
+                // discards the unsubmitted ones), then finish the rest synchronously.
+                if (!reap(submitted, ok)) return false;
+                delete ring;
+                ring = nullptr;
+                ::close(ring_fd);
+                ring_fd = -1;
+                for (size_t i = next - n + submitted; i < segments.size(); ++i) ok = run_sync(segments[i], 0) && ok;
+                return ok;
+            }
+            submitted += static_cast<unsigned>(r);
+        }
+        if (!reap(n, ok)) return false;
+    }
+    return ok;
+}
+
+bool BlockIO::submit() {
+    if (ops.empty()) return true;
+    bool ok = fd >= 0;
+    if (ok) {
+        build_segments();
+        if (ring) {
+            ok = run_uring();
+        } else {
+            for (const Segment& s : segments) ok = run_sync(s, 0) && ok;
+        }
+    }
+    ops.clear();
+    barrier_next = false;
+    return ok;
+}
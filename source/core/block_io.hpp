@@ -0,0 +1,68 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <sys/uio.h>
+
+// Positional reads and writes on the container, collected per operation and issued
+// together by submit(). With io_uring every run of adjacent requests becomes one
+// submission entry and the whole batch is one io_uring_enter; otherwise each run is one
+// preadv/pwritev. Requests are only queued until submit(), so buffers must stay valid
+// until then. Callers hold FSInstance::mtx; an engine is never used by two threads at once.
+class BlockIO {
+public:
+    enum class Engine { SYNC, URING };
+
+    BlockIO() = default;
+    BlockIO(const BlockIO&) = delete;
+    BlockIO& operator=(const BlockIO&) = delete;
+    ~BlockIO() { close(); }
+
+    // Opens path for reading and writing. want_uring tries io_uring first and falls back
+    // to the synchronous engine when the kernel (or a seccomp filter) refuses it.
+    bool open(const char* path, bool want_uring);
+    void close();
+    Engine engine() const { return ring_fd >= 0 ? Engine::URING : Engine::SYNC; }
+    const char* engine_name() const { return ring_fd >= 0 ? "io_uring" : "sync"; }
+
+    void add_read(uint64_t off, void* buf, size_t len) { queue(false, off, buf, len); }
+    void add_write(uint64_t off, const void* buf, size_t len) { queue(true, off, const_cast<void*>(buf), len); }
+    // Requests queued after this start only once every earlier one has completed, e.g. a
+    // chain pointer that must not reach the disk before the blocks it links to.
+    void barrier() { barrier_next = true; }
+    // Issues everything queued and waits for it. False if any request failed or came up short.
+    bool submit();
+
+private:
+    struct Op {
+        bool write;
+        bool barrier;
+        uint64_t off;
+        iovec iov;
+    };
+    // Adjacent requests of one kind merged into a single vectored call.
+    struct Segment {
+        bool write;
+        bool barrier;
+        uint64_t off;
+        size_t first_iov;
+        int iov_count;
+        size_t len;
+    };
+    struct Ring;
+
+    int fd = -1;
+    int ring_fd = -1;
+    Ring* ring = nullptr;
+    std::vector<Op> ops;
+    std::vector<iovec> iovs;
+    std::vector<Segment> segments;
+    bool barrier_next = false;
+
+    void queue(bool write, uint64_t off, void* buf, size_t len);
+    void build_segments();
+    bool run_sync(const Segment& s, size_t done);
+    bool run_uring();
+    bool reap(unsigned count, bool& ok);
+    bool setup_ring(unsigned entries);
+};
@@ -14,7 +14,9 @@ struct MetaEntry {
     uint32_t permissions; 
     uint64_t created_time; 
     uint64_t modified_time;
-    uint8_t reserved[18]; 
+    uint64_t version;      // contents version; survives the slot being freed and reused
+    uint32_t hole_blocks;  // files: trailing blocks of total_size with no storage yet
+    uint8_t reserved[6]; 
 
     MetaEntry() {
         valid = 1; 
@@ -27,6 +29,8 @@ struct MetaEntry {
         permissions = 0644;
         created_time = 0;
         modified_time = 0;
+        version = 0;
+        hole_blocks = 0;
         std::memset(reserved, 0, sizeof(reserved));
     }
 
@@ -11,6 +11,9 @@
 #include <memory>
 #include <random>
 #include <chrono>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <unistd.h>
 #include "ofs_instance.hpp"
 #include "meta_entry.hpp"
 #include "../data_structures/simple_unordered_map.hpp"
@@ -20,9 +23,21 @@ static uint32_t find_free_meta_index(FSInstance* inst);
 static bool dir_block_read(FSInstance* inst, const MetaEntry& dir, std::vector<uint32_t>& children);
 static bool dir_add_child(FSInstance* inst, MetaEntry& parent, uint32_t child_idx);
 static bool dir_remove_child(FSInstance* inst, MetaEntry& parent, uint32_t child_idx);
+static inline bool block_available(const FSInstance* inst, uint32_t i);
 FSInstance* g_fsinstance = nullptr;
 static inline int ofs_success() { return static_cast<int>(OFSErrorCodes::SUCCESS); }
 static inline int ofs_err(OFSErrorCodes e) { return static_cast<int>(e); }
+// The session making an API call, or nullptr if it is not attached to an instance.
+static inline SessionInfo* session_of(void* session) {
+    SessionInfo* s = reinterpret_cast<SessionInfo*>(session);
+    return s && s->inst ? s : nullptr;
+}
+// Records activity on the session making an API call. Caller holds inst->mtx, which also
+// keeps user_logout from erasing the session underneath.
+static inline void session_touch_locked(SessionInfo* s) {
+    s->operations_count++;
+    s->last_activity = (uint64_t)time(nullptr);
+}
 static std::string read_file_to_string(const char* path) {
     std::ifstream in(path);
     if (!in) return "";
@@ -38,6 +53,24 @@ static uint32_t find_free_meta_index(FSInstance* inst) {
     }
     return 0;
 }
+// Marks an entry, and the directory listing that shows it, as changed. Every call takes a
+// fresh value from one clock, so a reused meta slot never repeats an earlier generation.
+static void bump_generation(FSInstance* inst, uint32_t meta_index) {
+    if (meta_index == 0 || meta_index > inst->generations.size()) return;
+    uint64_t g = ++inst->generation_clock;
+    inst->generations[meta_index - 1] = g;
+    uint32_t parent = inst->meta_entries[meta_index - 1].parent;
+    if (parent && parent <= inst->generations.size()) inst->generations[parent - 1] = g;
+}
+// Records a change to a file's contents.
+static void touch_contents(MetaEntry& e) {
+    e.modified_time = (uint64_t)time(nullptr);
+    ++e.version;
+}
+static void bump_all_generations(FSInstance* inst) {
+    uint64_t g = ++inst->generation_clock;
+    for (uint64_t& v : inst->generations) v = g;
+}
 static bool dir_block_read(FSInstance* inst, const MetaEntry& dir, std::vector<uint32_t>& children) {
     children.clear();
     uint32_t cur = dir.start_index;
@@ -60,14 +93,16 @@ static bool dir_block_read(FSInstance* inst, const MetaEntry& dir, std::vector<u
     return true;
 }
 static bool dir_add_child(FSInstance* inst, MetaEntry& parent, uint32_t child_idx) {
+    bump_generation(inst, child_idx);
     std::vector<uint32_t> children;
     if (!dir_block_read(inst, parent, children)) return false;
     children.push_back(child_idx);
     uint32_t block_index = parent.start_index;
     uint32_t blk_size = static_cast<uint32_t>(inst->header.block_size);
     if (block_index == 0) {
+        std::lock_guard<std::mutex> hold_lock(inst->holds_mtx);
         for (uint32_t i = 0; i < inst->num_blocks; ++i) {
-            if (! (inst->free_bitmap[i/8] & (1 << (i % 8)))) {
+            if (block_available(inst, i)) {
                 block_index = i + 1;
                 inst->free_bitmap[i/8] |= (1 << (i % 8));
                 parent.start_index = block_index;
@@ -88,6 +123,7 @@ static bool dir_add_child(FSInstance* inst, MetaEntry& parent, uint32_t child_id
     return inst->file.good();
 }
 static bool dir_remove_child(FSInstance* inst, MetaEntry& parent, uint32_t child_idx) {
+    bump_generation(inst, child_idx);
     std::vector<uint32_t> children;
     if (!dir_block_read(inst, parent, children)) return false;
     auto it = std::find(children.begin(), children.end(), child_idx);
@@ -115,6 +151,7 @@ struct SimpleConfig {
     uint32_t max_users = 50;
     std::string admin_username = "admin";
     std::string admin_password = "admin123";
+    std::string io_engine = "auto";
     bool load(const char* path) {
         if (!path) return false;
         std::ifstream in(path);
@@ -143,6 +180,11 @@ struct SimpleConfig {
                 if (val.size() > 0 && val.front() == '"' && val.back() == '"') val = val.substr(1, val.size() - 2);
                 admin_password = val;
             }
+            else if (key == "io_engine") {
+                val = val.substr(0, val.find('#'));
+                trim(val);
+                io_engine = val;
+            }
         }
         return true;
     }
@@ -166,38 +208,62 @@ static std::string new_session_id() {
     snprintf(buf, sizeof(buf), "%016llx%016llx", (unsigned long long)r1, (unsigned long long)r2);
     return std::string(buf);
 }
-static bool write_block(std::fstream& f, uint64_t block_region_offset, uint32_t block_size, uint32_t block_index, uint32_t next_block, const uint8_t* data, size_t data_len) {
-    if (block_index == 0) return false;
-    uint64_t pos = block_region_offset + uint64_t(block_index - 1) * block_size;
-    f.seekp(pos, std::ios::beg);
-    if (!f.good()) return false;
-    uint32_t nb = next_block;
-    f.write(reinterpret_cast<const char*>(&nb), sizeof(nb));
-    size_t payload = (data_len > (size_t)block_size - 4) ? ((size_t)block_size - 4) : data_len;
-    if (payload > 0) f.write(reinterpret_cast<const char*>(data), payload);
-    size_t pad = (size_t)block_size - 4 - payload;
-    if (pad) {
-        static const char zeros[4096] = { 0 };
-        while (pad > 0) {
-            size_t w = std::min<size_t>(pad, sizeof(zeros));
-            f.write(zeros, w);
-            pad -= w; } }
-    f.flush();
-    return f.good();}
-static bool read_block(std::fstream& f, uint64_t block_region_offset, uint32_t block_size, uint32_t block_index, uint32_t& next_block, std::vector<uint8_t>& payload) {
-    payload.clear();
-    if (block_index == 0) { next_block = 0; return false; }
-    uint64_t pos = block_region_offset + uint64_t(block_index - 1) * block_size;
-    f.seekg(pos, std::ios::beg);
-    if (!f.good()) return false;
-    uint32_t nb = 0;
-    f.read(reinterpret_cast<char*>(&nb), sizeof(nb));
-    next_block = nb;
-    size_t payload_size = (size_t)block_size - 4;
-    payload.resize(payload_size);
-    f.read(reinterpret_cast<char*>(payload.data()), payload_size);
-    if (!f.good() && !f.eof()) return false;
+static inline uint64_t block_pos(const FSInstance* inst, uint32_t block_index) {
+    return (uint64_t)inst->blocks_offset + uint64_t(block_index - 1) * inst->header.block_size;}
+// Largest run of adjacent blocks fetched with one read while following a chain.
+static const uint32_t CHAIN_RUN_BLOCKS = 64;
+// Follows the chain from `start`, calling fn(block, next, payload) for each block until it
+// returns false or the chain ends. Files written in one go are usually laid out in adjacent
+// blocks, so up to CHAIN_RUN_BLOCKS of them (never more than `expect` still to come) are
+// read with a single request instead of one per block.
+template <typename Fn>
+static bool walk_chain(FSInstance* inst, uint32_t start, uint32_t expect, Fn fn) {
+    const uint32_t bs = static_cast<uint32_t>(inst->header.block_size);
+    std::vector<uint8_t> buf;
+    uint32_t cur = start;
+    uint32_t visited = 0;
+    while (cur) {
+        if (cur > inst->num_blocks || visited > inst->num_blocks) return false;
+        uint32_t run = (expect > visited) ? std::min(expect - visited, CHAIN_RUN_BLOCKS) : 1;
+        run = std::min(run, inst->num_blocks - cur + 1);
+        buf.resize(size_t(run) * bs);
+        inst->io.add_read(block_pos(inst, cur), buf.data(), buf.size());
+        if (!inst->io.submit()) return false;
+        for (uint32_t i = 0; ; ++i) {
+            const uint8_t* blk = buf.data() + size_t(i) * bs;
+            uint32_t next = 0;
+            std::memcpy(&next, blk, sizeof(next));
+            ++visited;
+            if (!fn(cur, next, blk + sizeof(next))) return true;
+            bool adjacent = (next == cur + 1 && i + 1 < run);
+            cur = next;
+            if (!adjacent || visited > inst->num_blocks) break;
+        }
+    }
     return true;}
+static inline uint32_t blocks_for_size(const FSInstance* inst, uint64_t size) {
+    uint64_t payload = inst->header.block_size - 4;
+    return static_cast<uint32_t>((size + payload - 1) / payload);}
+// Blocks in a file's chain. The chain covers the start of the file; the hole_blocks after
+// it have no storage and read as zeros.
+static inline uint32_t chain_blocks(const FSInstance* inst, const MetaEntry& e) {
+    uint32_t n = blocks_for_size(inst, e.total_size);
+    return n > e.hole_blocks ? n - e.hole_blocks : 0;}
+static std::vector<uint32_t> get_block_chain(FSInstance* inst, uint32_t start_index, uint32_t expect) {
+    std::vector<uint32_t> chain;
+    if (!inst || start_index == 0) return chain;
+    walk_chain(inst, start_index, expect, [&](uint32_t blk, uint32_t, const uint8_t*) { chain.push_back(blk); return true; });
+    return chain;
+}
+// Queues whole-block writes (next pointer, payload, zero padding) for a new chain; `image`
+// must hold blocks.size() * block_size bytes and stay alive until the submit.
+static void queue_chain_writes(FSInstance* inst, const std::vector<uint32_t>& blocks, std::vector<uint8_t>& image) {
+    const size_t bs = inst->header.block_size;
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        uint32_t next = (i + 1 < blocks.size()) ? blocks[i + 1] : 0;
+        std::memcpy(image.data() + i * bs, &next, sizeof(next));
+        inst->io.add_write(block_pos(inst, blocks[i]), image.data() + i * bs, bs);
+    }}
 static inline bool bitmap_get(const std::vector<uint8_t>& bits, uint32_t idx) {
     uint32_t byte_idx = idx / 8;
     uint8_t bit_mask = 1u << (idx % 8);
@@ -209,12 +275,29 @@ static inline void bitmap_set(std::vector<uint8_t>& bits, uint32_t idx, bool v)
     if (v) bits[byte_idx] |= bit_mask;
     else bits[byte_idx] &= ~bit_mask;
 }
+// Blocks that must not be handed out even if the bitmap shows them free: those of an upload
+// in progress, which reach the bitmap only at commit, and those a zero-copy download still
+// has queued for sendfile(), which may have been freed since. Holds are counted, so they nest.
+static void hold_blocks(FSInstance* inst, const std::vector<uint32_t>& blocks) {
+    std::lock_guard<std::mutex> lock(inst->holds_mtx);
+    if (inst->block_holds.empty()) inst->block_holds.resize(inst->num_blocks, 0);
+    for (uint32_t b : blocks)
+        if (b && b <= inst->num_blocks) ++inst->block_holds[b - 1];}
+static void release_blocks(FSInstance* inst, const std::vector<uint32_t>& blocks) {
+    std::lock_guard<std::mutex> lock(inst->holds_mtx);
+    for (uint32_t b : blocks)
+        if (b && b <= inst->num_blocks && inst->block_holds[b - 1]) --inst->block_holds[b - 1];}
+// Whether block i + 1 may be allocated. Caller holds inst->mtx and inst->holds_mtx.
+static inline bool block_available(const FSInstance* inst, uint32_t i) {
+    return !bitmap_get(inst->free_bitmap, i) && (inst->block_holds.empty() || !inst->block_holds[i]);
+}
 static std::vector<uint32_t> allocate_blocks(FSInstance* inst, uint32_t n) {
     std::vector<uint32_t> out;
     if (n == 0) return out;
     out.reserve(n);
+    std::lock_guard<std::mutex> hold_lock(inst->holds_mtx);
     for (uint32_t i = 0; i < inst->num_blocks && out.size() < n; ++i) {
-        if (!bitmap_get(inst->free_bitmap, i)) {
+        if (block_available(inst, i)) {
             bitmap_set(inst->free_bitmap, i, true);
             out.push_back(i + 1);} }
     if (out.size() < n) {
@@ -225,8 +308,11 @@ static std::vector<uint32_t> allocate_blocks(FSInstance* inst, uint32_t n) {
 static void free_blocks(FSInstance* inst, const std::vector<uint32_t>& blocks) {
     for (uint32_t b : blocks)
         if (b && b <= inst->num_blocks) bitmap_set(inst->free_bitmap, b - 1, false);}
+// Regions whose persist was deferred by fs_batch.
+enum : uint8_t { DIRTY_META = 1, DIRTY_BITMAP = 2, DIRTY_HEADER = 4 };
 static bool persist_bitmap(FSInstance* inst) {
     if (!inst) return false;
+    if (inst->defer_persist) { inst->dirty |= DIRTY_BITMAP; return true; }
     inst->file.seekp(inst->bitmap_offset, std::ios::beg);
     if (!inst->file.good()) return false;
     inst->file.write(reinterpret_cast<const char*>(inst->free_bitmap.data()), inst->free_bitmap.size());
@@ -234,6 +320,7 @@ static bool persist_bitmap(FSInstance* inst) {
     return inst->file.good();}
 static bool persist_meta_entries(FSInstance* inst) {
     if (!inst) return false;
+    if (inst->defer_persist) { inst->dirty |= DIRTY_META; return true; }
     inst->file.seekp(inst->metadata_offset, std::ios::beg);
     if (!inst->file.good()) return false;
     inst->file.write(reinterpret_cast<const char*>(inst->meta_entries.data()), inst->meta_entries.size() * sizeof(MetaEntry));
@@ -249,6 +336,7 @@ static bool persist_user_table(FSInstance* inst) {
     return inst->file.good();}
 static bool persist_header(FSInstance* inst) {
     if (!inst) return false;
+    if (inst->defer_persist) { inst->dirty |= DIRTY_HEADER; return true; }
     uint64_t v = inst->next_meta_index;
     if (sizeof(inst->header.reserved) >= 328)
         std::memcpy(inst->header.reserved + 320, &v, sizeof(v));
@@ -294,19 +382,61 @@ static std::string build_full_path_from_meta(const FSInstance* inst, uint32_t me
         path += "/";
         path += *it; }
     return path;}
-static void rebuild_path_index(FSInstance* inst) {
-    inst->path_index.clear();
+// Registered change watch. node is 0 once the watched entry has been deleted.
+struct FSWatch {
+    FSInstance* inst;
+    uint32_t node;
+    bool subtree;
+    OFSWatchCallback cb;
+    void* ctx;
+};
+// Calls the watches covering entry idx: those on idx itself or its parent, and subtree
+// watches on any further ancestor. For a move, old_parent adds the watches that covered the
+// old location. Must run while idx is still in use, so its path can be built.
+static void notify_watches(FSInstance* inst, OFSWatchEventType type, uint32_t idx, const char* old_path = nullptr, uint32_t old_parent = 0) {
+    if (inst->watch_count == 0) return;
+    std::vector<FSWatch*> hit;
+    auto collect = [&](uint32_t cur, uint32_t depth) {
+        for (; cur && cur <= inst->watches.size() && depth <= inst->meta_entries.size(); cur = inst->meta_entries[cur - 1].parent, ++depth)
+            for (FSWatch* w : inst->watches[cur - 1])
+                if ((depth <= 1 || w->subtree) && std::find(hit.begin(), hit.end(), w) == hit.end()) hit.push_back(w);
+    };
+    collect(idx, 0);
+    if (old_parent) collect(old_parent, 1);
+    if (hit.empty()) return;
+    std::string path = build_full_path_from_meta(inst, idx);
+    OFSWatchEvent ev{type, inst->meta_entries[idx - 1].type, idx, path.c_str(), old_path};
+    for (FSWatch* w : hit) w->cb(&ev, w->ctx);
+}
+// Drops the watches on entry idx, which is about to be freed; with notify each first gets
+// a DELETE event for it.
+static void detach_watches(FSInstance* inst, uint32_t idx, bool notify) {
+    if (inst->watch_count == 0 || idx == 0 || idx > inst->watches.size()) return;
+    std::vector<FSWatch*>& ws = inst->watches[idx - 1];
+    if (ws.empty()) return;
+    if (notify) {
+        std::string path = build_full_path_from_meta(inst, idx);
+        OFSWatchEvent ev{OFSWatchEventType::DELETE, inst->meta_entries[idx - 1].type, idx, path.c_str(), nullptr};
+        for (FSWatch* w : ws) w->cb(&ev, w->ctx);
+    }
+    for (FSWatch* w : ws) w->node = 0;
+    inst->watch_count -= ws.size();
+    ws.clear();
+}
+static void rebuild_path_tree(FSInstance* inst) {
     uint32_t count = static_cast<uint32_t>(inst->meta_entries.size());
-    for (uint32_t i = 0; i < count; ++i) {
+    inst->path_tree.reset(count);
+    for (uint32_t i = 1; i < count; ++i) {
         const MetaEntry& e = inst->meta_entries[i];
-        if (e.valid == 0) {
-            uint32_t meta_index = i + 1;
-            std::string full_path = build_full_path_from_meta(inst, meta_index);
-            inst->path_index.insert(full_path, meta_index);} }}
+        if (e.valid != 0 || e.parent == 0 || e.parent > count) continue;
+        std::string name = e.get_name();
+        if (name.empty()) name = "unnamed";
+        inst->path_tree.link(e.parent, name, i + 1); }}
 int user_login(void** session, const char* username, const char* password) {
     if (!session || !username || !password) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
     FSInstance* inst = g_fsinstance;
     if (!inst) return ofs_err(OFSErrorCodes::ERROR_INVALID_SESSION);
+    std::lock_guard<std::recursive_mutex> lock(inst->mtx);
     auto user_it = inst->user_index.find(username);
     size_t idx = SIZE_MAX;
     if (user_it) {
@@ -334,12 +464,16 @@ int user_logout(void* session) {
     SessionInfo* s = reinterpret_cast<SessionInfo*>(session);
     FSInstance* inst = s->inst;
     if (!inst) return ofs_err(OFSErrorCodes::ERROR_INVALID_SESSION);
+    std::lock_guard<std::recursive_mutex> lock(inst->mtx);
     inst->sessions.erase(s->session_id);
     return ofs_success();}
 int user_create(void* admin_session, const char* username, const char* password, UserRole role) {
     if (!admin_session || !username || !password) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
-    SessionInfo* sess = reinterpret_cast<SessionInfo*>(admin_session);
+    SessionInfo* sess = session_of(admin_session);
+    if (!sess) return ofs_err(OFSErrorCodes::ERROR_INVALID_SESSION);
     FSInstance* inst = sess->inst;
+    std::lock_guard<std::recursive_mutex> lock(inst->mtx);
+    session_touch_locked(sess);
     if (sess->user.role != UserRole::ADMIN) return ofs_err(OFSErrorCodes::ERROR_PERMISSION_DENIED);
     if (inst->user_index.contains(username)) return ofs_err(OFSErrorCodes::ERROR_FILE_EXISTS);
     int free_idx = -1;
@@ -350,18 +484,24 @@ int user_create(void* admin_session, const char* username, const char* password,
     UserInfo new_user(username, hash, role, (uint64_t)time(nullptr));
     inst->users[free_idx] = new_user;
     inst->user_index.insert(std::string(new_user.username), (size_t)free_idx);
+    // Listings show owner names by user slot, and a slot may now name someone else.
+    bump_all_generations(inst);
     persist_user_table(inst);
     return ofs_success();}
 int user_delete(void* admin_session, const char* username) {
     if (!admin_session || !username) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
-    SessionInfo* sess = reinterpret_cast<SessionInfo*>(admin_session);
+    SessionInfo* sess = session_of(admin_session);
+    if (!sess) return ofs_err(OFSErrorCodes::ERROR_INVALID_SESSION);
     FSInstance* inst = sess->inst;
+    std::lock_guard<std::recursive_mutex> lock(inst->mtx);
+    session_touch_locked(sess);
     if (sess->user.role != UserRole::ADMIN) return ofs_err(OFSErrorCodes::ERROR_PERMISSION_DENIED);
     auto user_it = inst->user_index.find(username);
     if (!user_it) return ofs_err(OFSErrorCodes::ERROR_NOT_FOUND);
     size_t idx = *user_it;
     UserInfo& user = inst->users[idx];
     user.is_active = 0;
+    bump_all_generations(inst);
     persist_user_table(inst);
     inst->user_index.erase(username);
     return ofs_success();
@@ -369,8 +509,11 @@ int user_delete(void* admin_session, const char* username) {
 
 int user_list(void* admin_session, UserInfo** users_out, int* count) {
     if (!admin_session || !users_out || !count) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
-    SessionInfo* sess = reinterpret_cast<SessionInfo*>(admin_session);
+    SessionInfo* sess = session_of(admin_session);
+    if (!sess) return ofs_err(OFSErrorCodes::ERROR_INVALID_SESSION);
     FSInstance* inst = sess->inst;
+    std::lock_guard<std::recursive_mutex> lock(inst->mtx);
+    session_touch_locked(sess);
     if (sess->user.role != UserRole::ADMIN) return ofs_err(OFSErrorCodes::ERROR_PERMISSION_DENIED);
 
     std::vector<UserInfo> found;
@@ -390,7 +533,9 @@ int user_list(void* admin_session, UserInfo** users_out, int* count) {
 
 int get_session_info(void* session, SessionInfo* info) {
     if (!session || !info) return ofs_err(OFSErrorCodes::ERROR_INVALID_SESSION);
-    SessionInfo* s = reinterpret_cast<SessionInfo*>(session);
+    SessionInfo* s = session_of(session);
+    if (!s) return ofs_err(OFSErrorCodes::ERROR_INVALID_SESSION);
+    std::lock_guard<std::recursive_mutex> lock(s->inst->mtx);
     std::memcpy(info, s, sizeof(SessionInfo));
     return ofs_success();
 }
@@ -411,16 +556,13 @@ static std::vector<std::string> split_path_tokens(const std::string& path) {
     return out;
 }
 
-int file_create(void* session, const char* path_c, const char* data, size_t size) {
-    if (!session || !path_c) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
-    SessionInfo* s = reinterpret_cast<SessionInfo*>(session);
-    FSInstance* inst = s->inst;
-    std::string path(path_c);
+// Splits an absolute path into its parent directory's meta index and the basename.
+static int resolve_parent(FSInstance* inst, const std::string& path, uint32_t& parent_meta, std::string& basename) {
     if (path.empty() || path[0] != '/') return ofs_err(OFSErrorCodes::ERROR_INVALID_PATH);
-
     auto tokens = split_path_tokens(path);
     if (tokens.empty()) return ofs_err(OFSErrorCodes::ERROR_INVALID_PATH);
-    std::string basename = tokens.back();
+    basename = tokens.back();
+    if (basename.size() > sizeof(MetaEntry::name) - 1) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
     std::string parent_path = "/";
     if (tokens.size() > 1) {
         parent_path.clear();
@@ -429,11 +571,16 @@ int file_create(void* session, const char* path_c, const char* data, size_t size
             parent_path += tokens[i];
         }
     }
-    const uint32_t* pIndex = inst->path_index.find(parent_path);
+    uint32_t pIndex = inst->path_tree.resolve(parent_path);
     if (!pIndex) return ofs_err(OFSErrorCodes::ERROR_NOT_FOUND);
-    uint32_t parent_meta = *pIndex;
-    if (inst->path_index.contains(path)) return ofs_err(OFSErrorCodes::ERROR_FILE_EXISTS);
-
+    parent_meta = pIndex;
+    if (inst->path_tree.lookup(parent_meta, basename)) return ofs_err(OFSErrorCodes::ERROR_FILE_EXISTS);
+    return ofs_success();
+}
+// Creates the metadata entry for a file whose block chain is already written, then persists it.
+// On failure nothing is linked and the slot is free again; the chain stays the caller's to free.
+static int link_file_entry(FSInstance* inst, SessionInfo* s, uint32_t parent_meta, const std::string& basename,
+                           uint32_t first_block, uint64_t size) {
     uint32_t meta_index = find_free_meta_index(inst);
     if (meta_index == 0) return ofs_err(OFSErrorCodes::ERROR_NO_SPACE);
     MetaEntry& entry = inst->meta_entries[meta_index - 1];
@@ -442,60 +589,212 @@ int file_create(void* session, const char* path_c, const char* data, size_t size
     entry.parent = parent_meta;
     entry.set_name(basename);
     entry.total_size = size;
+    entry.hole_blocks = 0;
     entry.permissions = 0644;
     auto it = inst->user_index.find(s->user.username);
     entry.owner_id = (it ? static_cast<uint32_t>(*it) : 0);
     uint64_t now = (uint64_t)std::time(nullptr);
     entry.created_time = now;
     entry.modified_time = now;
+    ++entry.version;
+    entry.start_index = first_block;
+    if (inst->next_meta_index <= meta_index) inst->next_meta_index = meta_index + 1;
+    if (!persist_meta_entries(inst) || !persist_bitmap(inst) || !persist_header(inst)) {
+        entry.valid = 1;
+        persist_meta_entries(inst);
+        return ofs_err(OFSErrorCodes::ERROR_IO_ERROR);
+    }
+    if (!dir_add_child(inst, inst->meta_entries[parent_meta - 1], meta_index)) {
+        // best effort: leave entry but try to persist
+    }
+    inst->path_tree.link(parent_meta, basename, meta_index);
+    notify_watches(inst, OFSWatchEventType::CREATE, meta_index);
+    return ofs_success();
+}
+
+static int file_create_locked(SessionInfo* s, const char* path_c, const char* data, size_t size) {
+    FSInstance* inst = s->inst;
+    std::string path(path_c);
+    uint32_t parent_meta = 0;
+    std::string basename;
+    int r = resolve_parent(inst, path, parent_meta, basename);
+    if (r != ofs_success()) return r;
+    if (find_free_meta_index(inst) == 0) return ofs_err(OFSErrorCodes::ERROR_NO_SPACE);
 
     uint32_t block_payload = static_cast<uint32_t>(inst->header.block_size - 4);
     uint32_t need_blocks = (size == 0) ? 0 : static_cast<uint32_t>((size + block_payload - 1) / block_payload);
     std::vector<uint32_t> blocks;
     if (need_blocks > 0) {
         blocks = allocate_blocks(inst, need_blocks);
-        if (blocks.empty()) { entry.valid = 1; return ofs_err(OFSErrorCodes::ERROR_NO_SPACE); }
+        if (blocks.empty()) return ofs_err(OFSErrorCodes::ERROR_NO_SPACE);
     }
+    // All data blocks go out as one batch, and complete, before the entry is linked.
     const uint8_t* src = reinterpret_cast<const uint8_t*>(data);
-    uint32_t first_block = 0;
+    const size_t bs = inst->header.block_size;
+    std::vector<uint8_t> image(blocks.size() * bs, 0);
+    std::vector<uint8_t> enc;
     for (size_t i = 0; i < blocks.size(); ++i) {
-        uint32_t blk_idx = blocks[i];
-        uint32_t next = (i + 1 < blocks.size()) ? blocks[i + 1] : 0;
         size_t offset = i * (size_t)block_payload;
         size_t chunk = std::min<size_t>((size - offset), (size_t)block_payload);
-        std::vector<uint8_t> enc;
         encode_data(inst, src + offset, chunk, enc);
-        if (!write_block(inst->file, inst->blocks_offset, static_cast<uint32_t>(inst->header.block_size), blk_idx, next, enc.data(), enc.size())) {
-            free_blocks(inst, blocks);
-            entry.valid = 1;
-            return ofs_err(OFSErrorCodes::ERROR_IO_ERROR);
-        }
-        if (i == 0) first_block = blk_idx;
+        std::memcpy(image.data() + i * bs + 4, enc.data(), enc.size());
     }
-    entry.start_index = first_block;
-    if (inst->next_meta_index <= meta_index) inst->next_meta_index = meta_index + 1;
-    if (!persist_meta_entries(inst)) return ofs_err(OFSErrorCodes::ERROR_IO_ERROR);
-    if (!persist_bitmap(inst)) return ofs_err(OFSErrorCodes::ERROR_IO_ERROR);
-    if (!persist_header(inst)) return ofs_err(OFSErrorCodes::ERROR_IO_ERROR);
-    if (!dir_add_child(inst, inst->meta_entries[parent_meta - 1], meta_index)) {
-        // best effort: leave entry but try to persist
+    queue_chain_writes(inst, blocks, image);
+    if (!inst->io.submit()) {
+        free_blocks(inst, blocks);
+        return ofs_err(OFSErrorCodes::ERROR_IO_ERROR);
     }
-    inst->path_index.insert(path, meta_index);
+    uint32_t first_block = blocks.empty() ? 0 : blocks[0];
+    r = link_file_entry(inst, s, parent_meta, basename, first_block, size);
+    if (r != ofs_success()) {
+        free_blocks(inst, blocks);
+        persist_bitmap(inst);
+    }
+    return r;
+}
+int file_create(void* session, const char* path_c, const char* data, size_t size) {
+    if (!session || !path_c) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    SessionInfo* s = session_of(session);
+    if (!s) return ofs_err(OFSErrorCodes::ERROR_INVALID_SESSION);
+    std::lock_guard<std::recursive_mutex> lock(s->inst->mtx);
+    session_touch_locked(s);
+    return file_create_locked(s, path_c, data, size);
+}
+
+// Streaming upload state. At most one block of payload is buffered: a full block is only
+// written once the next block has been allocated, so its next pointer is known. The blocks
+// are held (see hold_blocks) rather than set in the bitmap until commit, so no bitmap write
+// made meanwhile can record them as in use.
+struct FileUpload {
+    SessionInfo* session;
+    std::string path;
+    std::vector<uint32_t> blocks;   // allocated so far, in chain order
+    std::vector<uint8_t> pending;   // blocks.back() as it will be written: next pointer, then payload so far
+    uint64_t size;
+    uint32_t alloc_hint;            // bitmap position to resume the free-block scan from
+};
+// Reserves a free block for an upload: held, but not yet set in the bitmap.
+static uint32_t reserve_block_from(FSInstance* inst, uint32_t& hint) {
+    std::lock_guard<std::mutex> hold_lock(inst->holds_mtx);
+    if (inst->block_holds.empty()) inst->block_holds.resize(inst->num_blocks, 0);
+    for (uint32_t n = 0; n < inst->num_blocks; ++n) {
+        uint32_t i = (hint + n) % inst->num_blocks;
+        if (block_available(inst, i)) {
+            ++inst->block_holds[i];
+            hint = i + 1;
+            return i + 1; } }
+    return 0;}
+static bool upload_flush_pending(FileUpload* u, uint32_t next) {
+    FSInstance* inst = u->session->inst;
+    if (u->blocks.empty()) return true;
+    std::memcpy(u->pending.data(), &next, sizeof(next));
+    u->pending.resize(inst->header.block_size, 0);
+    inst->io.add_write(block_pos(inst, u->blocks.back()), u->pending.data(), u->pending.size());
+    bool ok = inst->io.submit();
+    u->pending.clear();
+    return ok;}
+int file_upload_begin(void* session, const char* path_c, void** upload) {
+    if (!session || !path_c || !upload) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    SessionInfo* s = session_of(session);
+    if (!s) return ofs_err(OFSErrorCodes::ERROR_INVALID_SESSION);
+    std::lock_guard<std::recursive_mutex> lock(s->inst->mtx);
+    session_touch_locked(s);
+    uint32_t parent_meta = 0;
+    std::string basename;
+    int r = resolve_parent(s->inst, path_c, parent_meta, basename);
+    if (r != ofs_success()) return r;
+    FileUpload* u = new FileUpload();
+    u->session = s;
+    u->path = path_c;
+    u->size = 0;
+    u->alloc_hint = 0;
+    *upload = u;
+    return ofs_success();
+}
+int file_upload_write(void* upload, const char* data, size_t size) {
+    if (!upload || (!data && size > 0)) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    FileUpload* u = reinterpret_cast<FileUpload*>(upload);
+    FSInstance* inst = u->session->inst;
+    std::lock_guard<std::recursive_mutex> lock(inst->mtx);
+    const size_t bs = inst->header.block_size;
+    std::vector<uint8_t> enc;
+    encode_data(inst, reinterpret_cast<const uint8_t*>(data), size, enc);
+    size_t off = 0;
+    while (off < size) {
+        if (u->blocks.empty() || u->pending.size() == bs) {
+            uint32_t blk = reserve_block_from(inst, u->alloc_hint);
+            if (blk == 0) return ofs_err(OFSErrorCodes::ERROR_NO_SPACE);
+            if (!upload_flush_pending(u, blk)) {
+                release_blocks(inst, std::vector<uint32_t>(1, blk));
+                return ofs_err(OFSErrorCodes::ERROR_IO_ERROR); }
+            u->blocks.push_back(blk);
+            u->pending.reserve(bs);
+            u->pending.assign(sizeof(uint32_t), 0); }
+        size_t take = std::min(size - off, bs - u->pending.size());
+        u->pending.insert(u->pending.end(), enc.begin() + off, enc.begin() + off + take);
+        off += take;
+        u->size += take; }
+    return ofs_success();
+}
+int file_upload_commit(void* upload) {
+    if (!upload) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    FileUpload* u = reinterpret_cast<FileUpload*>(upload);
+    FSInstance* inst = u->session->inst;
+    std::lock_guard<std::recursive_mutex> lock(inst->mtx);
+    uint32_t parent_meta = 0;
+    std::string basename;
+    // The namespace may have changed while the data was streaming in.
+    int r = resolve_parent(inst, u->path, parent_meta, basename);
+    if (r == ofs_success() && !upload_flush_pending(u, 0)) r = ofs_err(OFSErrorCodes::ERROR_IO_ERROR);
+    if (r == ofs_success()) {
+        // The chain is complete on disk; it enters the bitmap with the entry that owns it.
+        for (uint32_t b : u->blocks) bitmap_set(inst->free_bitmap, b - 1, true);
+        r = link_file_entry(inst, u->session, parent_meta, basename, u->blocks.empty() ? 0 : u->blocks.front(), u->size);
+        if (r != ofs_success()) {
+            free_blocks(inst, u->blocks);
+            persist_bitmap(inst);
+        }
+    }
+    release_blocks(inst, u->blocks);
+    delete u;
+    return r;
+}
+int file_upload_abort(void* upload) {
+    if (!upload) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    FileUpload* u = reinterpret_cast<FileUpload*>(upload);
+    std::lock_guard<std::recursive_mutex> lock(u->session->inst->mtx);
+    release_blocks(u->session->inst, u->blocks);
+    delete u;
     return ofs_success();
 }
 
 int file_read(void* session, const char* path_c, char** buffer, size_t* size_out) {
-    if (!session || !path_c || !buffer || !size_out) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
-    SessionInfo* s = reinterpret_cast<SessionInfo*>(session);
+    OFSVersionTag tag;
+    return file_read_tagged(session, path_c, nullptr, buffer, size_out, &tag);
+}
+int file_read_tagged(void* session, const char* path_c, const OFSVersionTag* if_tag,
+                     char** buffer, size_t* size_out, OFSVersionTag* tag_out) {
+    if (!session || !path_c || !buffer || !size_out || !tag_out) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    SessionInfo* s = session_of(session);
+    if (!s) return ofs_err(OFSErrorCodes::ERROR_INVALID_SESSION);
     FSInstance* inst = s->inst;
+    std::lock_guard<std::recursive_mutex> lock(inst->mtx);
+    session_touch_locked(s);
     std::string path(path_c);
-    const uint32_t* pm = inst->path_index.find(path);
+    uint32_t pm = inst->path_tree.resolve(path);
     if (!pm) return ofs_err(OFSErrorCodes::ERROR_NOT_FOUND);
-    uint32_t meta_index = *pm;
+    uint32_t meta_index = pm;
     if (meta_index == 0 || meta_index > inst->meta_entries.size()) return ofs_err(OFSErrorCodes::ERROR_NOT_FOUND);
     MetaEntry& entry = inst->meta_entries[meta_index - 1];
     if (entry.valid != 0) return ofs_err(OFSErrorCodes::ERROR_NOT_FOUND);
     if (entry.type != 0) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    tag_out->inode = meta_index;
+    tag_out->version = entry.version;
+    if (if_tag && if_tag->inode == tag_out->inode && if_tag->version == tag_out->version) {
+        *buffer = nullptr;
+        *size_out = 0;
+        return ofs_success();
+    }
 
     uint64_t total_size = entry.total_size;
     if (total_size == 0) {
@@ -508,21 +807,18 @@ int file_read(void* session, const char* path_c, char** buffer, size_t* size_out
 
     std::vector<uint8_t> file_data;
     file_data.reserve((size_t)total_size);
-    uint32_t current_block = entry.start_index;
     uint64_t bytes_remaining = total_size;
-    while (current_block != 0 && bytes_remaining > 0) {
-        uint32_t next_block = 0;
-        std::vector<uint8_t> payload;
-        if (!read_block(inst->file, inst->blocks_offset, static_cast<uint32_t>(inst->header.block_size), current_block, next_block, payload)) {
-            return ofs_err(OFSErrorCodes::ERROR_IO_ERROR);
-        }
-        size_t chunk_size = static_cast<size_t>(std::min<uint64_t>(bytes_remaining, payload.size()));
-        std::vector<uint8_t> decoded;
-        decode_data(inst, payload.data(), chunk_size, decoded);
-        file_data.insert(file_data.end(), decoded.begin(), decoded.end());
-        bytes_remaining -= chunk_size;
-        current_block = next_block;
-    }
+    const size_t payload_size = (size_t)inst->header.block_size - 4;
+    std::vector<uint8_t> decoded;
+    bool read_ok = walk_chain(inst, entry.start_index, chain_blocks(inst, entry),
+        [&](uint32_t, uint32_t, const uint8_t* payload) {
+            size_t chunk_size = static_cast<size_t>(std::min<uint64_t>(bytes_remaining, payload_size));
+            decode_data(inst, payload, chunk_size, decoded);
+            file_data.insert(file_data.end(), decoded.begin(), decoded.end());
+            bytes_remaining -= chunk_size;
+            return bytes_remaining > 0; });
+    if (!read_ok) return ofs_err(OFSErrorCodes::ERROR_IO_ERROR);
+    if (entry.hole_blocks) file_data.resize(static_cast<size_t>(total_size), 0);
 
     *buffer = (char*)malloc(file_data.size());
     if (!*buffer) return ofs_err(OFSErrorCodes::ERROR_NO_SPACE);
@@ -531,103 +827,172 @@ int file_read(void* session, const char* path_c, char** buffer, size_t* size_out
     return ofs_success();
 }
 
-int file_delete(void* session, const char* path_c) {
-    if (!session || !path_c) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
-    SessionInfo* s = reinterpret_cast<SessionInfo*>(session);
+static int file_delete_locked(SessionInfo* s, const char* path_c) {
     FSInstance* inst = s->inst;
     std::string path(path_c);
-    const uint32_t* meta_idx = inst->path_index.find(path);
+    uint32_t meta_idx = inst->path_tree.resolve(path);
     if (!meta_idx) return ofs_err(OFSErrorCodes::ERROR_NOT_FOUND);
-    MetaEntry& entry = inst->meta_entries[*meta_idx - 1];
+    MetaEntry& entry = inst->meta_entries[meta_idx - 1];
     if (entry.valid || entry.type != 0) return ofs_err(OFSErrorCodes::ERROR_NOT_FOUND);
+    bump_generation(inst, meta_idx);
     std::vector<uint32_t> free_list;
-    uint32_t cur = entry.start_index;
-    while (cur) {
-        free_list.push_back(cur);
-        uint32_t next = 0;
-        std::vector<uint8_t> payload;
-        if (!read_block(inst->file, inst->blocks_offset, inst->header.block_size, cur, next, payload))
-            break;
-        cur = next; }
+    walk_chain(inst, entry.start_index, chain_blocks(inst, entry),
+               [&](uint32_t blk, uint32_t, const uint8_t*) { free_list.push_back(blk); return true; });
     free_blocks(inst, free_list);
     uint32_t parent_idx = entry.parent;
     if (parent_idx && parent_idx <= inst->meta_entries.size()) {
         MetaEntry& parent = inst->meta_entries[parent_idx - 1];
-        dir_remove_child(inst, parent, *meta_idx);
+        dir_remove_child(inst, parent, meta_idx);
     }
+    notify_watches(inst, OFSWatchEventType::DELETE, meta_idx);
+    detach_watches(inst, meta_idx, false);
     entry.valid = 1;
     entry.start_index = 0;
     entry.total_size = 0;
+    entry.hole_blocks = 0;
+    inst->incarnations[meta_idx - 1]++;
+    inst->path_tree.unlink(parent_idx, entry.get_name());
     persist_meta_entries(inst);
     persist_bitmap(inst);
-    rebuild_path_index(inst);
+    return ofs_success();
+}
+int file_delete(void* session, const char* path_c) {
+    if (!session || !path_c) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    SessionInfo* s = session_of(session);
+    if (!s) return ofs_err(OFSErrorCodes::ERROR_INVALID_SESSION);
+    std::lock_guard<std::recursive_mutex> lock(s->inst->mtx);
+    session_touch_locked(s);
+    return file_delete_locked(s, path_c);
+}
+// Gives storage to the holes of a file up to the block holding byte end - 1, so bytes up to
+// `end` can be written in place. The new blocks are written whole: `enc` (the encoded bytes
+// of [offset, end)) where they overlap that range, zeros elsewhere. They are linked to the
+// chain (after `last`, its current last block) only once they are on disk. The caller
+// persists the metadata, bitmap and header.
+static int fill_holes(FSInstance* inst, MetaEntry& entry, uint32_t last, uint64_t offset, uint64_t end,
+                      const uint8_t* enc, std::vector<uint32_t>& added) {
+    const size_t bs = inst->header.block_size;
+    const uint64_t payload = bs - 4;
+    uint32_t have = chain_blocks(inst, entry);
+    uint32_t need = blocks_for_size(inst, end);
+    added.clear();
+    if (need <= have) return ofs_success();
+    added = allocate_blocks(inst, need - have);
+    if (added.empty()) return ofs_err(OFSErrorCodes::ERROR_NO_SPACE);
+    std::vector<uint8_t> zeros(payload, 0), zero_enc;
+    encode_data(inst, zeros.data(), zeros.size(), zero_enc);
+    std::vector<uint8_t> image(added.size() * bs);
+    for (size_t i = 0; i < added.size(); ++i) std::memcpy(image.data() + i * bs + 4, zero_enc.data(), payload);
+    uint64_t base = uint64_t(have) * payload;
+    for (uint64_t pos = std::max(offset, base); pos < end; ) {
+        uint64_t rel = pos - base;
+        size_t n = static_cast<size_t>(std::min<uint64_t>(end - pos, payload - rel % payload));
+        std::memcpy(image.data() + (rel / payload) * bs + 4 + rel % payload, enc + (pos - offset), n);
+        pos += n;
+    }
+    queue_chain_writes(inst, added, image);
+    if (have) {
+        inst->io.barrier();
+        inst->io.add_write(block_pos(inst, last), &added[0], sizeof(uint32_t));
+    }
+    if (!inst->io.submit()) {
+        free_blocks(inst, added);
+        added.clear();
+        return ofs_err(OFSErrorCodes::ERROR_IO_ERROR);
+    }
+    if (!have) entry.start_index = added[0];
+    entry.hole_blocks -= need - have;
     return ofs_success();
 }
 int file_edit(void* session, const char* path_c, const char* data, size_t size, uint index) {
     if (!session || !path_c || !data) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
-    SessionInfo* s = reinterpret_cast<SessionInfo*>(session);
+    SessionInfo* s = session_of(session);
+    if (!s) return ofs_err(OFSErrorCodes::ERROR_INVALID_SESSION);
     FSInstance* inst = s->inst;
+    std::lock_guard<std::recursive_mutex> lock(inst->mtx);
+    session_touch_locked(s);
     std::string path(path_c);
-    const uint32_t* meta_idx = inst->path_index.find(path);
+    uint32_t meta_idx = inst->path_tree.resolve(path);
     if (!meta_idx) return ofs_err(OFSErrorCodes::ERROR_NOT_FOUND);
-    MetaEntry& entry = inst->meta_entries[*meta_idx - 1];
+    MetaEntry& entry = inst->meta_entries[meta_idx - 1];
     if (entry.valid || entry.type != 0) return ofs_err(OFSErrorCodes::ERROR_NOT_FOUND);
     if (index > entry.total_size) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    bump_generation(inst, meta_idx);
     uint32_t block_payload = static_cast<uint32_t>(inst->header.block_size - 4);
     uint32_t block_no = static_cast<uint32_t>(index / block_payload);
     uint32_t offset_in_block = static_cast<uint32_t>(index % block_payload);
-    uint32_t cur = entry.start_index;
-    for (uint32_t i = 0; i < block_no && cur; ++i) {
-        uint32_t next = 0;
-        std::vector<uint8_t> payload;
-        if (!read_block(inst->file, inst->blocks_offset, static_cast<uint32_t>(inst->header.block_size), cur, next, payload)) {
-            return ofs_err(OFSErrorCodes::ERROR_IO_ERROR);}
-        cur = next;}
-    if (cur == 0) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    uint32_t stored = chain_blocks(inst, entry);
+    if (block_no >= stored && block_no < blocks_for_size(inst, entry.total_size)) {
+        // The block is a hole; it and any holes before it get storage now.
+        std::vector<uint32_t> chain = get_block_chain(inst, entry.start_index, stored);
+        if (chain.size() < stored) return ofs_err(OFSErrorCodes::ERROR_IO_ERROR);
+        size_t write_len = std::min<size_t>(size, block_payload - offset_in_block);
+        std::vector<uint8_t> enc;
+        encode_data(inst, reinterpret_cast<const uint8_t*>(data), write_len, enc);
+        std::vector<uint32_t> blocks;
+        int r = fill_holes(inst, entry, chain.empty() ? 0 : chain.back(), index, index + write_len, enc.data(), blocks);
+        if (r != ofs_success()) return r;
+        touch_contents(entry);
+        persist_meta_entries(inst);
+        persist_bitmap(inst);
+        persist_header(inst);
+        notify_watches(inst, OFSWatchEventType::MODIFY, meta_idx);
+        return ofs_success();
+    }
+    uint32_t cur = 0;
     uint32_t next = 0;
+    uint32_t seen = 0;
     std::vector<uint8_t> payload;
-    if (!read_block(inst->file, inst->blocks_offset, inst->header.block_size, cur, next, payload))
-        return ofs_err(OFSErrorCodes::ERROR_IO_ERROR);
+    bool walked = walk_chain(inst, entry.start_index, block_no + 1, [&](uint32_t blk, uint32_t nb, const uint8_t* p) {
+        if (seen++ < block_no) return true;
+        cur = blk;
+        next = nb;
+        payload.assign(p, p + inst->header.block_size - 4);
+        return false; });
+    if (!walked) return ofs_err(OFSErrorCodes::ERROR_IO_ERROR);
+    if (cur == 0) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
     std::vector<uint8_t> dec;
     decode_data(inst, payload.data(), payload.size(), dec);
     size_t write_len = std::min(size, payload.size() - offset_in_block);
     std::memcpy(dec.data() + offset_in_block, data, write_len);
     std::vector<uint8_t> enc;
     encode_data(inst, dec.data(), dec.size(), enc);
-    if (!write_block(inst->file, inst->blocks_offset, inst->header.block_size, cur, next, enc.data(), enc.size()))
-        return ofs_err(OFSErrorCodes::ERROR_IO_ERROR);
-    entry.modified_time = (uint64_t)time(nullptr);
+    inst->io.add_write(block_pos(inst, cur), &next, sizeof(next));
+    inst->io.add_write(block_pos(inst, cur) + sizeof(next), enc.data(), enc.size());
+    if (!inst->io.submit()) return ofs_err(OFSErrorCodes::ERROR_IO_ERROR);
+    touch_contents(entry);
     persist_meta_entries(inst);
+    notify_watches(inst, OFSWatchEventType::MODIFY, meta_idx);
     return ofs_success();}
-int dir_create(void* session, const char* path_c) {
-    if (!session || !path_c) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
-    SessionInfo* s = reinterpret_cast<SessionInfo*>(session);
+static int dir_create_locked(SessionInfo* s, const char* path_c) {
     FSInstance* inst = s->inst;
     std::string path(path_c);
     if (path.empty() || path[0] != '/') return ofs_err(OFSErrorCodes::ERROR_INVALID_PATH);
     auto tokens = split_path_tokens(path);
     if (tokens.empty()) return ofs_err(OFSErrorCodes::ERROR_INVALID_PATH);
     std::string basename = tokens.back();
+    if (basename.size() > sizeof(MetaEntry::name) - 1) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
     std::string parent_path = "/";
     if (tokens.size() > 1) {
         parent_path.clear();
         for (size_t i = 0; i + 1 < tokens.size(); ++i) {
             parent_path += "/";
             parent_path += tokens[i]; }}
-    const uint32_t* parent_idx = inst->path_index.find(parent_path);
+    uint32_t parent_idx = inst->path_tree.resolve(parent_path);
     if (!parent_idx) return ofs_err(OFSErrorCodes::ERROR_NOT_FOUND);
-    MetaEntry& parent = inst->meta_entries[*parent_idx - 1];
+    MetaEntry& parent = inst->meta_entries[parent_idx - 1];
     if (parent.type != 1 || parent.valid != 0) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
-    if (inst->path_index.contains(path)) return ofs_err(OFSErrorCodes::ERROR_FILE_EXISTS);
+    if (inst->path_tree.lookup(parent_idx, basename)) return ofs_err(OFSErrorCodes::ERROR_FILE_EXISTS);
     uint32_t meta_index = find_free_meta_index(inst);
     if (meta_index == 0) return ofs_err(OFSErrorCodes::ERROR_NO_SPACE);
     MetaEntry& entry = inst->meta_entries[meta_index - 1];
     entry.valid = 0;
     entry.type = 1;
-    entry.parent = *parent_idx;
+    entry.parent = parent_idx;
     entry.set_name(basename);
     entry.start_index = 0;
     entry.total_size = 0;
+    entry.hole_blocks = 0;
     entry.permissions = 0755;
     auto user_it = inst->user_index.find(s->user.username);
     entry.owner_id = (user_it ? static_cast<uint32_t>(*user_it) : 0);
@@ -641,142 +1006,540 @@ int dir_create(void* session, const char* path_c) {
     if (inst->next_meta_index <= meta_index) inst->next_meta_index = meta_index + 1;
     if (!persist_meta_entries(inst)) return ofs_err(OFSErrorCodes::ERROR_IO_ERROR);
     if (!persist_header(inst)) return ofs_err(OFSErrorCodes::ERROR_IO_ERROR);
-    rebuild_path_index(inst);
+    inst->path_tree.link(parent_idx, basename, meta_index);
+    notify_watches(inst, OFSWatchEventType::CREATE, meta_index);
+    return ofs_success();
+}
+int dir_create(void* session, const char* path_c) {
+    if (!session || !path_c) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    SessionInfo* s = session_of(session);
+    if (!s) return ofs_err(OFSErrorCodes::ERROR_INVALID_SESSION);
+    std::lock_guard<std::recursive_mutex> lock(s->inst->mtx);
+    session_touch_locked(s);
+    return dir_create_locked(s, path_c);
+}
+static void fill_file_entry(const FSInstance* inst, uint32_t meta_index, const std::string& name, FileEntry& fe) {
+    const MetaEntry& me = inst->meta_entries[meta_index - 1];
+    std::memset(&fe, 0, sizeof(FileEntry));
+    std::strncpy(fe.name, name.c_str(), sizeof(fe.name) - 1);
+    fe.type = me.type;
+    fe.size = me.total_size;
+    fe.permissions = me.permissions;
+    fe.created_time = me.created_time;
+    fe.modified_time = me.modified_time;
+    if (me.owner_id < inst->users.size())
+        std::strncpy(fe.owner, inst->users[me.owner_id].username, sizeof(fe.owner) - 1);
+    else
+        std::strncpy(fe.owner, "unknown", sizeof(fe.owner) - 1);
+    fe.inode = meta_index;
+    fe.version = me.version;
+}
+static int copy_entries_out(const std::vector<FileEntry>& file_entries, FileEntry** entries, int* count) {
+    *entries = nullptr;
+    *count = 0;
+    if (file_entries.empty()) return ofs_success();
+    *entries = (FileEntry*) malloc(file_entries.size() * sizeof(FileEntry));
+    if (!*entries) return ofs_err(OFSErrorCodes::ERROR_NO_SPACE);
+    std::memcpy(*entries, file_entries.data(), file_entries.size() * sizeof(FileEntry));
+    *count = (int)file_entries.size();
     return ofs_success();
 }
 int dir_list(void* session, const char* path_c, FileEntry** entries, int* count) {
     if (!session || !path_c || !entries || !count) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
-    SessionInfo* s = reinterpret_cast<SessionInfo*>(session);
+    SessionInfo* s = session_of(session);
+    if (!s) return ofs_err(OFSErrorCodes::ERROR_INVALID_SESSION);
     FSInstance* inst = s->inst;
+    std::lock_guard<std::recursive_mutex> lock(inst->mtx);
+    session_touch_locked(s);
     std::string path(path_c);
-    const uint32_t* dir_idx = inst->path_index.find(path);
+    uint32_t dir_idx = inst->path_tree.resolve(path);
     if (!dir_idx) return ofs_err(OFSErrorCodes::ERROR_NOT_FOUND);
-    MetaEntry& dir = inst->meta_entries[*dir_idx - 1];
+    MetaEntry& dir = inst->meta_entries[dir_idx - 1];
     if (dir.type != 1) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
     std::vector<uint32_t> child_indices;
     if (!dir_block_read(inst, dir, child_indices)) return ofs_err(OFSErrorCodes::ERROR_IO_ERROR);
     std::vector<FileEntry> file_entries;
     for (uint32_t idx : child_indices) {
         if (idx == 0 || idx > inst->meta_entries.size()) continue;
-        const MetaEntry& me = inst->meta_entries[idx - 1];
-        if (me.valid != 0) continue;
-        FileEntry fe;
-        std::strncpy(fe.name, me.name, sizeof(fe.name) - 1);
-        fe.type = me.type;
-        fe.size = me.total_size;
-        fe.permissions = me.permissions;
-        fe.created_time = me.created_time;
-        fe.modified_time = me.modified_time;
-        if (me.owner_id < inst->users.size()) {
-            std::strncpy(fe.owner, inst->users[me.owner_id].username, sizeof(fe.owner) - 1);
-        } else {
-            std::strncpy(fe.owner, "unknown", sizeof(fe.owner) - 1);
-        }
-        fe.inode = idx;
-        file_entries.push_back(fe); }
-    if (file_entries.empty()) {
-        *entries = nullptr;
-        *count = 0;
-        return ofs_success();  }
-    *entries = (FileEntry*) malloc(file_entries.size() * sizeof(FileEntry));
-    if (!*entries) return ofs_err(OFSErrorCodes::ERROR_NO_SPACE);
-    std::memcpy(*entries, file_entries.data(), file_entries.size() * sizeof(FileEntry));
-    *count = (int)file_entries.size();
+        if (inst->meta_entries[idx - 1].valid != 0) continue;
+        file_entries.emplace_back();
+        fill_file_entry(inst, idx, inst->meta_entries[idx - 1].get_name(), file_entries.back()); }
+    return copy_entries_out(file_entries, entries, count);
+}
+static char* dup_cursor(const std::string& s) {
+    char* out = (char*) malloc(s.size() + 1);
+    if (out) std::memcpy(out, s.c_str(), s.size() + 1);
+    return out;
+}
+// Shared body of the paged listings: calls add(name, idx) for up to limit children of path
+// after `after` and sets *next_cursor if more remain.
+template <typename Fn>
+static int dir_page_locked(FSInstance* inst, const char* path_c, const char* after, int limit, char** next_cursor, Fn add) {
+    uint32_t dir_idx = inst->path_tree.resolve(path_c);
+    if (!dir_idx) return ofs_err(OFSErrorCodes::ERROR_NOT_FOUND);
+    if (inst->meta_entries[dir_idx - 1].type != 1) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    int n = 0;
+    std::string last;
+    bool more = false;
+    inst->path_tree.scan_after(dir_idx, after ? after : "", [&](const std::string& name, uint32_t idx) {
+        if (n == limit) { more = true; return false; }
+        add(name, idx);
+        last = name;
+        ++n;
+        return true; });
+    if (more && !(*next_cursor = dup_cursor(last))) return ofs_err(OFSErrorCodes::ERROR_NO_SPACE);
     return ofs_success();
 }
-int dir_delete(void* session, const char* path_c) {
-    if (!session || !path_c) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
-    SessionInfo* s = reinterpret_cast<SessionInfo*>(session);
+int dir_list_page(void* session, const char* path_c, const char* after, int limit,
+                  FileEntry** entries, int* count, char** next_cursor) {
+    if (!session || !path_c || !entries || !count || !next_cursor || limit <= 0) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    *next_cursor = nullptr;
+    SessionInfo* s = session_of(session);
+    if (!s) return ofs_err(OFSErrorCodes::ERROR_INVALID_SESSION);
+    FSInstance* inst = s->inst;
+    std::lock_guard<std::recursive_mutex> lock(inst->mtx);
+    session_touch_locked(s);
+    std::vector<FileEntry> page;
+    int r = dir_page_locked(inst, path_c, after, limit, next_cursor, [&](const std::string& name, uint32_t idx) {
+        page.emplace_back();
+        fill_file_entry(inst, idx, name, page.back()); });
+    if (r == ofs_success()) r = copy_entries_out(page, entries, count);
+    if (r != ofs_success()) { free(*next_cursor); *next_cursor = nullptr; }
+    return r;
+}
+int dir_list_names(void* session, const char* path_c, const char* after, int limit,
+                   OFSNameEntry** entries, int* count, char** next_cursor) {
+    if (!session || !path_c || !entries || !count || !next_cursor || limit <= 0) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    *entries = nullptr;
+    *count = 0;
+    *next_cursor = nullptr;
+    SessionInfo* s = session_of(session);
+    if (!s) return ofs_err(OFSErrorCodes::ERROR_INVALID_SESSION);
+    FSInstance* inst = s->inst;
+    std::lock_guard<std::recursive_mutex> lock(inst->mtx);
+    session_touch_locked(s);
+    std::vector<OFSNameEntry> page;
+    int r = dir_page_locked(inst, path_c, after, limit, next_cursor, [&](const std::string& name, uint32_t idx) {
+        page.emplace_back();
+        std::memset(&page.back(), 0, sizeof(OFSNameEntry));
+        std::strncpy(page.back().name, name.c_str(), sizeof(page.back().name) - 1);
+        page.back().type = inst->meta_entries[idx - 1].type; });
+    if (r == ofs_success() && !page.empty()) {
+        *entries = (OFSNameEntry*) malloc(page.size() * sizeof(OFSNameEntry));
+        if (*entries) {
+            std::memcpy(*entries, page.data(), page.size() * sizeof(OFSNameEntry));
+            *count = (int)page.size();
+        } else r = ofs_err(OFSErrorCodes::ERROR_NO_SPACE);
+    }
+    if (r != ofs_success()) { free(*next_cursor); *next_cursor = nullptr; }
+    return r;
+}
+int path_prefix_scan(void* session, const char* prefix_c, int subtree, FileEntry** entries, int* count) {
+    if (!session || !prefix_c || !entries || !count) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    SessionInfo* s = session_of(session);
+    if (!s) return ofs_err(OFSErrorCodes::ERROR_INVALID_SESSION);
+    FSInstance* inst = s->inst;
+    std::lock_guard<std::recursive_mutex> lock(inst->mtx);
+    session_touch_locked(s);
+    std::string prefix(prefix_c);
+    if (prefix.empty() || prefix[0] != '/') return ofs_err(OFSErrorCodes::ERROR_INVALID_PATH);
+    size_t slash = prefix.find_last_of('/');
+    std::string dir_path = prefix.substr(0, slash + 1);
+    std::string name_prefix = prefix.substr(slash + 1);
+    uint32_t dir_idx = inst->path_tree.resolve(dir_path);
+    if (!dir_idx) return ofs_err(OFSErrorCodes::ERROR_NOT_FOUND);
+    if (inst->meta_entries[dir_idx - 1].type != 1) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    std::string base = build_full_path_from_meta(inst, dir_idx);
+    if (base.back() != '/') base += '/';
+    std::vector<FileEntry> found;
+    auto add = [&](const std::string& path, uint32_t idx) {
+        found.emplace_back();
+        fill_file_entry(inst, idx, path, found.back());
+    };
+    inst->path_tree.scan(dir_idx, name_prefix, [&](const std::string& name, uint32_t idx) {
+        std::string path = base + name;
+        add(path, idx);
+        if (subtree)
+            inst->path_tree.walk(idx, [&](const std::string& rel, uint32_t child) { add(path + "/" + rel, child); return true; });
+        return true; });
+    return copy_entries_out(found, entries, count);
+}
+// Entries one fs_find call may visit before it returns a cursor.
+static const size_t FIND_SCAN_BUDGET = 65536;
+static bool find_matches(const FSInstance* inst, const OFSFindFilter& f, const std::string& rel, uint32_t idx) {
+    const MetaEntry& me = inst->meta_entries[idx - 1];
+    if (f.type == 1 && me.type != 0) return false;
+    if (f.type == 2 && me.type != 1) return false;
+    if (me.total_size < f.min_size || (f.max_size && me.total_size > f.max_size)) return false;
+    if (me.modified_time < f.modified_after || (f.modified_before && me.modified_time > f.modified_before)) return false;
+    if (f.owner && *f.owner) {
+        if (me.owner_id >= inst->users.size() || std::strcmp(inst->users[me.owner_id].username, f.owner) != 0) return false;
+    }
+    if (f.name && *f.name) {
+        if (std::strchr(f.name, '/')) return fnmatch(f.name, rel.c_str(), FNM_PATHNAME) == 0;
+        size_t slash = rel.find_last_of('/');
+        return fnmatch(f.name, rel.c_str() + (slash == std::string::npos ? 0 : slash + 1), 0) == 0;
+    }
+    return true;
+}
+int fs_find(void* session, const char* root_c, const OFSFindFilter* filter, const char* cursor, int limit,
+            FileEntry** entries, int* count, char** next_cursor) {
+    if (!session || !root_c || !entries || !count || !next_cursor || limit <= 0) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    *next_cursor = nullptr;
+    SessionInfo* s = session_of(session);
+    if (!s) return ofs_err(OFSErrorCodes::ERROR_INVALID_SESSION);
+    FSInstance* inst = s->inst;
+    std::lock_guard<std::recursive_mutex> lock(inst->mtx);
+    session_touch_locked(s);
+    uint32_t root_idx = inst->path_tree.resolve(root_c);
+    if (!root_idx) return ofs_err(OFSErrorCodes::ERROR_NOT_FOUND);
+    if (inst->meta_entries[root_idx - 1].type != 1) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    OFSFindFilter f;
+    if (filter) f = *filter;
+    else std::memset(&f, 0, sizeof(f));
+    std::string base = build_full_path_from_meta(inst, root_idx);
+    if (base.back() != '/') base += '/';
+    std::vector<FileEntry> found;
+    std::string last;
+    size_t visited = 0;
+    auto visit = [&](const std::string& rel, uint32_t idx) {
+        if (found.size() >= static_cast<size_t>(limit) || visited >= FIND_SCAN_BUDGET) return false;
+        ++visited;
+        last = rel;
+        if (find_matches(inst, f, rel, idx)) {
+            found.emplace_back();
+            fill_file_entry(inst, idx, base + rel, found.back());
+        }
+        return true;
+    };
+    std::vector<std::string> after;
+    for (const char* p = cursor; p && *p;) {
+        const char* e = std::strchr(p, '/');
+        after.emplace_back(p, e ? e - p : std::strlen(p));
+        p = e ? e + 1 : p + after.back().size();
+    }
+    bool done = after.empty() ? inst->path_tree.walk(root_idx, visit) : inst->path_tree.walk_after(root_idx, after, visit);
+    if (!done && !(*next_cursor = dup_cursor(last))) return ofs_err(OFSErrorCodes::ERROR_NO_SPACE);
+    int r = copy_entries_out(found, entries, count);
+    if (r != 0) { free(*next_cursor); *next_cursor = nullptr; }
+    return r;
+}
+static int dir_delete_locked(SessionInfo* s, const char* path_c) {
     FSInstance* inst = s->inst;
     std::string path(path_c);
     if (path.empty() || path == "/") return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
-    const uint32_t* dir_idx = inst->path_index.find(path);
+    uint32_t dir_idx = inst->path_tree.resolve(path);
     if (!dir_idx) return ofs_err(OFSErrorCodes::ERROR_NOT_FOUND);
-    MetaEntry& dir = inst->meta_entries[*dir_idx - 1];
+    MetaEntry& dir = inst->meta_entries[dir_idx - 1];
     if (dir.type != 1) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
-    std::vector<uint32_t> children;
-    if (!dir_block_read(inst, dir, children)) return ofs_err(OFSErrorCodes::ERROR_IO_ERROR);
-    if (!children.empty()) return ofs_err(OFSErrorCodes::ERROR_DIRECTORY_NOT_EMPTY);
+    if (inst->path_tree.has_children(dir_idx)) return ofs_err(OFSErrorCodes::ERROR_DIRECTORY_NOT_EMPTY);
+    bump_generation(inst, dir_idx);
     uint32_t parent_idx = dir.parent;
     if (parent_idx == 0 || parent_idx > inst->meta_entries.size()) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
     MetaEntry& parent = inst->meta_entries[parent_idx - 1];
-    if (!dir_remove_child(inst, parent, *dir_idx)) return ofs_err(OFSErrorCodes::ERROR_IO_ERROR);
+    if (!dir_remove_child(inst, parent, dir_idx)) return ofs_err(OFSErrorCodes::ERROR_IO_ERROR);
+    notify_watches(inst, OFSWatchEventType::DELETE, dir_idx);
+    detach_watches(inst, dir_idx, false);
     dir.valid = 1;
     if (dir.start_index) free_blocks(inst, std::vector<uint32_t>{dir.start_index});
     dir.start_index = 0;
+    inst->path_tree.unlink(parent_idx, dir.get_name());
     persist_meta_entries(inst);
-    rebuild_path_index(inst);
+    return ofs_success();
+}
+int dir_delete(void* session, const char* path_c) {
+    if (!session || !path_c) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    SessionInfo* s = session_of(session);
+    if (!s) return ofs_err(OFSErrorCodes::ERROR_INVALID_SESSION);
+    std::lock_guard<std::recursive_mutex> lock(s->inst->mtx);
+    session_touch_locked(s);
+    return dir_delete_locked(s, path_c);
+}
+// dir_idx followed by everything below it, parents before their children.
+static std::vector<uint32_t> subtree_nodes(const FSInstance* inst, uint32_t dir_idx) {
+    std::vector<uint32_t> nodes{dir_idx};
+    inst->path_tree.walk(dir_idx, [&](const std::string&, uint32_t idx) { nodes.push_back(idx); return true; });
+    return nodes;
+}
+int dir_delete_tree(void* session, const char* path_c) {
+    if (!session || !path_c) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    SessionInfo* s = session_of(session);
+    if (!s) return ofs_err(OFSErrorCodes::ERROR_INVALID_SESSION);
+    FSInstance* inst = s->inst;
+    std::lock_guard<std::recursive_mutex> lock(inst->mtx);
+    session_touch_locked(s);
+    uint32_t top = inst->path_tree.resolve(path_c);
+    if (!top) return ofs_err(OFSErrorCodes::ERROR_NOT_FOUND);
+    if (top == inst->path_tree.root() || inst->meta_entries[top - 1].type != 1) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    uint32_t parent_idx = inst->meta_entries[top - 1].parent;
+    if (parent_idx == 0 || parent_idx > inst->meta_entries.size()) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    std::vector<uint32_t> nodes = subtree_nodes(inst, top);
+    std::vector<uint32_t> free_list;
+    for (uint32_t idx : nodes) {
+        const MetaEntry& e = inst->meta_entries[idx - 1];
+        if (e.type == 1) {
+            if (e.start_index) free_list.push_back(e.start_index);
+        } else if (!walk_chain(inst, e.start_index, chain_blocks(inst, e),
+                               [&](uint32_t blk, uint32_t, const uint8_t*) { free_list.push_back(blk); return true; })) {
+            return ofs_err(OFSErrorCodes::ERROR_IO_ERROR);
+        }
+    }
+    // Only the top directory is unlinked on disk; its descendants go with their metadata
+    // entries, and the metadata and bitmap are written once for the whole subtree.
+    if (!dir_remove_child(inst, inst->meta_entries[parent_idx - 1], top)) return ofs_err(OFSErrorCodes::ERROR_IO_ERROR);
+    notify_watches(inst, OFSWatchEventType::DELETE, top);
+    for (size_t i = 0; i < nodes.size(); ++i) detach_watches(inst, nodes[i], i > 0);
+    for (auto it = nodes.rbegin(); it != nodes.rend(); ++it) {
+        MetaEntry& e = inst->meta_entries[*it - 1];
+        bump_generation(inst, *it);
+        inst->path_tree.unlink(e.parent, e.get_name());
+        if (e.type == 0) inst->incarnations[*it - 1]++;
+        e.valid = 1;
+        e.start_index = 0;
+        e.total_size = 0;
+        e.hole_blocks = 0;
+    }
+    free_blocks(inst, free_list);
+    if (!persist_meta_entries(inst) || !persist_bitmap(inst)) return ofs_err(OFSErrorCodes::ERROR_IO_ERROR);
+    return ofs_success();
+}
+// Copy data queued by dir_copy_tree before it is flushed.
+static const size_t COPY_TREE_BATCH_BYTES = 8u << 20;
+int dir_copy_tree(void* session, const char* src_c, const char* dst_c) {
+    if (!session || !src_c || !dst_c) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    SessionInfo* s = session_of(session);
+    if (!s) return ofs_err(OFSErrorCodes::ERROR_INVALID_SESSION);
+    FSInstance* inst = s->inst;
+    std::lock_guard<std::recursive_mutex> lock(inst->mtx);
+    session_touch_locked(s);
+    uint32_t src_idx = inst->path_tree.resolve(src_c);
+    if (!src_idx) return ofs_err(OFSErrorCodes::ERROR_NOT_FOUND);
+    if (inst->meta_entries[src_idx - 1].type != 1) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    uint32_t parent_meta = 0;
+    std::string basename;
+    int r = resolve_parent(inst, dst_c, parent_meta, basename);
+    if (r != ofs_success()) return r;
+    if (inst->meta_entries[parent_meta - 1].type != 1) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    for (uint32_t p = parent_meta; p; p = inst->path_tree.parent(p))
+        if (p == src_idx) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    std::vector<uint32_t> nodes = subtree_nodes(inst, src_idx);
+
+    // Metadata slots and blocks for the whole copy are reserved first, so it either fits or
+    // fails before anything is written.
+    std::vector<uint32_t> slots;
+    for (uint32_t i = 0; i < inst->meta_entries.size() && slots.size() < nodes.size(); ++i)
+        if (inst->meta_entries[i].valid) slots.push_back(i + 1);
+    if (slots.size() < nodes.size()) return ofs_err(OFSErrorCodes::ERROR_NO_SPACE);
+    std::vector<uint32_t> pos_of(inst->meta_entries.size() + 1, 0);
+    std::vector<std::vector<uint32_t>> kids(nodes.size());
+    uint32_t need = 0;
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        const MetaEntry& e = inst->meta_entries[nodes[i] - 1];
+        pos_of[nodes[i]] = static_cast<uint32_t>(i);
+        if (i) kids[pos_of[e.parent]].push_back(slots[i]);
+        need += (e.type == 1) ? (inst->path_tree.has_children(nodes[i]) ? 1 : 0) : chain_blocks(inst, e);
+    }
+    std::vector<uint32_t> blocks = allocate_blocks(inst, need);
+    if (need && blocks.empty()) return ofs_err(OFSErrorCodes::ERROR_NO_SPACE);
+
+    // File chains are copied block for block (payloads stay encoded), directories get a fresh
+    // child block listing the new entries. Writes are queued and flushed in large batches.
+    const size_t bs = inst->header.block_size;
+    const size_t payload_count = (bs - sizeof(uint32_t)) / sizeof(uint32_t);
+    std::vector<uint32_t> first(nodes.size(), 0);
+    std::vector<std::vector<uint8_t>> images;
+    size_t queued = 0, next_block = 0;
+    bool ok = true;
+    for (size_t i = 0; i < nodes.size() && ok; ++i) {
+        const MetaEntry& e = inst->meta_entries[nodes[i] - 1];
+        uint32_t n = (e.type == 1) ? (kids[i].empty() ? 0 : 1) : chain_blocks(inst, e);
+        if (n == 0) continue;
+        std::vector<uint32_t> chain(blocks.begin() + next_block, blocks.begin() + next_block + n);
+        next_block += n;
+        first[i] = chain[0];
+        images.emplace_back(n * bs, 0);
+        std::vector<uint8_t>& image = images.back();
+        if (e.type == 1) {
+            std::memcpy(image.data() + sizeof(uint32_t), kids[i].data(), std::min(kids[i].size(), payload_count) * sizeof(uint32_t));
+        } else {
+            uint32_t k = 0;
+            ok = walk_chain(inst, e.start_index, n, [&](uint32_t, uint32_t, const uint8_t* payload) {
+                if (k >= n) return false;
+                std::memcpy(image.data() + size_t(k++) * bs + sizeof(uint32_t), payload, bs - sizeof(uint32_t));
+                return true; }) && k == n;
+        }
+        queue_chain_writes(inst, chain, image);
+        queued += image.size();
+        if (queued >= COPY_TREE_BATCH_BYTES) {
+            ok = inst->io.submit() && ok;
+            images.clear();
+            queued = 0;
+        }
+    }
+    ok = inst->io.submit() && ok;
+    if (!ok) {
+        free_blocks(inst, blocks);
+        return ofs_err(OFSErrorCodes::ERROR_IO_ERROR);
+    }
+
+    auto user_it = inst->user_index.find(s->user.username);
+    uint32_t owner = user_it ? static_cast<uint32_t>(*user_it) : 0;
+    uint64_t now = static_cast<uint64_t>(time(nullptr));
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        MetaEntry& e = inst->meta_entries[slots[i] - 1];
+        uint64_t version = e.version;
+        e = inst->meta_entries[nodes[i] - 1];
+        e.version = version + 1;
+        if (i == 0) e.set_name(basename);
+        e.parent = i ? slots[pos_of[e.parent]] : parent_meta;
+        e.start_index = first[i];
+        e.owner_id = owner;
+        e.created_time = now;
+        e.modified_time = now;
+        bump_generation(inst, slots[i]);
+        if (i) inst->path_tree.link(e.parent, e.get_name(), slots[i]);
+        if (inst->next_meta_index <= slots[i]) inst->next_meta_index = slots[i] + 1;
+    }
+    if (!persist_meta_entries(inst) || !persist_bitmap(inst) || !persist_header(inst)) return ofs_err(OFSErrorCodes::ERROR_IO_ERROR);
+    if (!dir_add_child(inst, inst->meta_entries[parent_meta - 1], slots[0])) return ofs_err(OFSErrorCodes::ERROR_IO_ERROR);
+    inst->path_tree.link(parent_meta, basename, slots[0]);
+    notify_watches(inst, OFSWatchEventType::CREATE, slots[0]);
+    return ofs_success();
+}
+int fs_watch_add(void* session, const char* path_c, int subtree, OFSWatchCallback cb, void* ctx, void** watch) {
+    if (!session || !path_c || !cb || !watch) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    SessionInfo* s = session_of(session);
+    if (!s) return ofs_err(OFSErrorCodes::ERROR_INVALID_SESSION);
+    FSInstance* inst = s->inst;
+    std::lock_guard<std::recursive_mutex> lock(inst->mtx);
+    session_touch_locked(s);
+    uint32_t idx = inst->path_tree.resolve(path_c);
+    if (!idx) return ofs_err(OFSErrorCodes::ERROR_NOT_FOUND);
+    if (inst->watches.size() < inst->meta_entries.size()) inst->watches.resize(inst->meta_entries.size());
+    FSWatch* w = new FSWatch{inst, idx, subtree != 0, cb, ctx};
+    inst->watches[idx - 1].push_back(w);
+    inst->watch_count++;
+    *watch = w;
+    return ofs_success();
+}
+int fs_watch_remove(void* watch) {
+    if (!watch) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    FSWatch* w = reinterpret_cast<FSWatch*>(watch);
+    FSInstance* inst = w->inst;
+    std::lock_guard<std::recursive_mutex> lock(inst->mtx);
+    if (w->node) {
+        std::vector<FSWatch*>& ws = inst->watches[w->node - 1];
+        ws.erase(std::find(ws.begin(), ws.end(), w));
+        inst->watch_count--;
+    }
+    delete w;
     return ofs_success();
 }
 int dir_exists(void* session, const char* path_c) {
     if (!session || !path_c) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
-    SessionInfo* s = reinterpret_cast<SessionInfo*>(session);
+    SessionInfo* s = session_of(session);
+    if (!s) return ofs_err(OFSErrorCodes::ERROR_INVALID_SESSION);
     FSInstance* inst = s->inst;
+    std::lock_guard<std::recursive_mutex> lock(inst->mtx);
+    session_touch_locked(s);
     std::string path(path_c);
-    const uint32_t* idx = inst->path_index.find(path);
+    uint32_t idx = inst->path_tree.resolve(path);
     if (!idx) return ofs_err(OFSErrorCodes::ERROR_NOT_FOUND);
-    const MetaEntry& meta = inst->meta_entries[*idx - 1];
+    const MetaEntry& meta = inst->meta_entries[idx - 1];
     if (meta.type == 1 && meta.valid == 0) return ofs_success();
     return ofs_err(OFSErrorCodes::ERROR_NOT_FOUND);
 }
+static void fill_metadata(const FSInstance* inst, uint32_t meta_index, const std::string& path, uint32_t blocks_used, FileMetadata* meta) {
+    FileEntry fe;
+    fill_file_entry(inst, meta_index, inst->meta_entries[meta_index - 1].get_name(), fe);
+    std::memset(meta, 0, sizeof(FileMetadata));
+    std::strncpy(meta->path, path.c_str(), sizeof(meta->path) - 1);
+    std::memcpy(&meta->entry, &fe, sizeof(FileEntry));
+    meta->blocks_used = blocks_used;
+    meta->actual_size = uint64_t(blocks_used) * inst->header.block_size;
+}
 int get_metadata(void* session, const char* path_c, FileMetadata* meta) {
     if (!session || !path_c || !meta) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
-    SessionInfo* s = reinterpret_cast<SessionInfo*>(session);
+    SessionInfo* s = session_of(session);
+    if (!s) return ofs_err(OFSErrorCodes::ERROR_INVALID_SESSION);
     FSInstance* inst = s->inst;
+    std::lock_guard<std::recursive_mutex> lock(inst->mtx);
+    session_touch_locked(s);
     std::string path(path_c);
-    const uint32_t* meta_idx = inst->path_index.find(path);
+    uint32_t meta_idx = inst->path_tree.resolve(path);
     if (!meta_idx) return ofs_err(OFSErrorCodes::ERROR_NOT_FOUND);
-    const MetaEntry& me = inst->meta_entries[*meta_idx - 1];
+    const MetaEntry& me = inst->meta_entries[meta_idx - 1];
     if (me.valid != 0) return ofs_err(OFSErrorCodes::ERROR_NOT_FOUND);
-    FileEntry fe;
-    std::memset(&fe, 0, sizeof(FileEntry));
-    std::strncpy(fe.name, me.name, sizeof(fe.name) - 1);
-    fe.type = me.type;
-    fe.size = me.total_size;
-    fe.permissions = me.permissions;
-    fe.created_time = me.created_time;
-    fe.modified_time = me.modified_time;
-    if (me.owner_id < inst->users.size())
-        std::strncpy(fe.owner, inst->users[me.owner_id].username, sizeof(fe.owner) - 1);
-    else
-        std::strncpy(fe.owner, "unknown", sizeof(fe.owner) - 1);
-    fe.inode = *meta_idx;
-    std::memset(meta, 0, sizeof(FileMetadata));
-    std::strncpy(meta->path, path.c_str(), sizeof(meta->path) - 1);
-    std::memcpy(&meta->entry, &fe, sizeof(FileEntry));
     uint32_t count = 0;
-    uint64_t used_bytes = 0;
-    uint32_t blk = me.start_index;
-    while (blk) {
-        count++;
-        uint32_t next = 0;
-        std::vector<uint8_t> payload;
-        if (!read_block(inst->file, inst->blocks_offset, inst->header.block_size, blk, next, payload)) break;
-        used_bytes += payload.size();
-        blk = next;
-    }
-    meta->blocks_used = count;
-    meta->actual_size = count * inst->header.block_size;
+    walk_chain(inst, me.start_index, chain_blocks(inst, me),
+               [&](uint32_t, uint32_t, const uint8_t*) { ++count; return true; });
+    fill_metadata(inst, meta_idx, path, count, meta);
     return ofs_success();
 }
-int set_permissions(void* session, const char* path_c, uint32_t permissions) {
-    if (!session || !path_c) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
-    SessionInfo* s = reinterpret_cast<SessionInfo*>(session);
+int get_generation(void* session, const char* path_c, uint32_t* inode, uint64_t* generation) {
+    if (!session || !path_c || !inode || !generation) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    SessionInfo* s = session_of(session);
+    if (!s) return ofs_err(OFSErrorCodes::ERROR_INVALID_SESSION);
+    FSInstance* inst = s->inst;
+    std::lock_guard<std::recursive_mutex> lock(inst->mtx);
+    session_touch_locked(s);
+    uint32_t meta_idx = inst->path_tree.resolve(path_c);
+    if (!meta_idx || meta_idx > inst->generations.size()) return ofs_err(OFSErrorCodes::ERROR_NOT_FOUND);
+    if (inst->meta_entries[meta_idx - 1].valid != 0) return ofs_err(OFSErrorCodes::ERROR_NOT_FOUND);
+    *inode = meta_idx;
+    *generation = inst->generations[meta_idx - 1];
+    return ofs_success();
+}
+static int set_permissions_locked(SessionInfo* s, const char* path_c, uint32_t permissions) {
     FSInstance* inst = s->inst;
     std::string path(path_c);
-    const uint32_t* meta_idx = inst->path_index.find(path);
+    uint32_t meta_idx = inst->path_tree.resolve(path);
     if (!meta_idx) return ofs_err(OFSErrorCodes::ERROR_NOT_FOUND);
-    MetaEntry& me = inst->meta_entries[*meta_idx - 1];
+    MetaEntry& me = inst->meta_entries[meta_idx - 1];
     if (me.valid != 0) return ofs_err(OFSErrorCodes::ERROR_NOT_FOUND);
+    bump_generation(inst, meta_idx);
     me.permissions = permissions;
     me.modified_time = (uint64_t)time(nullptr);
     persist_meta_entries(inst);
+    notify_watches(inst, OFSWatchEventType::MODIFY, meta_idx);
+    return ofs_success();
+}
+int set_permissions(void* session, const char* path_c, uint32_t permissions) {
+    if (!session || !path_c) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    SessionInfo* s = session_of(session);
+    if (!s) return ofs_err(OFSErrorCodes::ERROR_INVALID_SESSION);
+    std::lock_guard<std::recursive_mutex> lock(s->inst->mtx);
+    session_touch_locked(s);
+    return set_permissions_locked(s, path_c, permissions);
+}
+int set_owner(void* session, const char* path_c, const char* username) {
+    if (!session || !path_c || !username) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    SessionInfo* s = session_of(session);
+    if (!s) return ofs_err(OFSErrorCodes::ERROR_INVALID_SESSION);
+    FSInstance* inst = s->inst;
+    std::lock_guard<std::recursive_mutex> lock(inst->mtx);
+    session_touch_locked(s);
+    if (s->user.role != UserRole::ADMIN) return ofs_err(OFSErrorCodes::ERROR_PERMISSION_DENIED);
+    uint32_t meta_idx = inst->path_tree.resolve(path_c);
+    if (!meta_idx) return ofs_err(OFSErrorCodes::ERROR_NOT_FOUND);
+    MetaEntry& me = inst->meta_entries[meta_idx - 1];
+    if (me.valid != 0) return ofs_err(OFSErrorCodes::ERROR_NOT_FOUND);
+    auto it = inst->user_index.find(username);
+    if (!it) return ofs_err(OFSErrorCodes::ERROR_NOT_FOUND);
+    bump_generation(inst, meta_idx);
+    me.owner_id = static_cast<uint32_t>(*it);
+    me.modified_time = (uint64_t)time(nullptr);
+    persist_meta_entries(inst);
+    notify_watches(inst, OFSWatchEventType::MODIFY, meta_idx);
     return ofs_success();
 }
 int get_stats(void* session, FSStats* stats) {
     if (!session || !stats) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
-    SessionInfo* s = reinterpret_cast<SessionInfo*>(session);
+    SessionInfo* s = session_of(session);
+    if (!s) return ofs_err(OFSErrorCodes::ERROR_INVALID_SESSION);
     FSInstance* inst = s->inst;
+    std::lock_guard<std::recursive_mutex> lock(inst->mtx);
+    session_touch_locked(s);
     uint64_t used_blocks = 0;
     for (uint32_t i = 0; i < inst->num_blocks; ++i) {
         if (bitmap_get(inst->free_bitmap, i)) used_blocks++;
@@ -823,6 +1586,7 @@ const char* get_error_message(int error_code) {
         case OFSErrorCodes::ERROR_INVALID_SESSION: return "Invalid session";
         case OFSErrorCodes::ERROR_DIRECTORY_NOT_EMPTY: return "Directory not empty";
         case OFSErrorCodes::ERROR_INVALID_OPERATION: return "Invalid operation";
+        case OFSErrorCodes::ERROR_FILE_CHANGED: return "File changed";
         default: return "Unknown error";
     }
 }
@@ -930,9 +1694,21 @@ int fs_shutdown(void* instance) {
     persist_meta_entries(inst);
     persist_bitmap(inst);
     if (inst->file.is_open()) inst->file.close();
+    if (inst->raw_fd >= 0) close(inst->raw_fd);
+    inst->io.close();
     delete inst;
     return ofs_success();
 }
+const char* fs_io_engine(void* instance) {
+    if (!instance) return "none";
+    return reinterpret_cast<FSInstance*>(instance)->io.engine_name();
+}
+int fs_try_lock(void* instance) {
+    return instance && reinterpret_cast<FSInstance*>(instance)->mtx.try_lock() ? 1 : 0;
+}
+void fs_unlock(void* instance) {
+    reinterpret_cast<FSInstance*>(instance)->mtx.unlock();
+}
 
 int fs_init(void** instance, const char* omni_path, const char* config_path) {
     if (!instance || !omni_path) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
@@ -1005,6 +1781,8 @@ int fs_init(void** instance, const char* omni_path, const char* config_path) {
     uint32_t meta_count = static_cast<uint32_t>(metadata_size_bytes / sizeof(MetaEntry));
     inst->max_files = meta_count;
     inst->meta_entries.resize(meta_count);
+    inst->generations.assign(meta_count, 0);
+    inst->incarnations.assign(meta_count, 0);
     inst->file.seekg(inst->metadata_offset, std::ios::beg);
     inst->file.read(reinterpret_cast<char*>(inst->meta_entries.data()), meta_count * sizeof(MetaEntry));
     uint64_t user_table_size = uint64_t(max_users) * sizeof(UserInfo);
@@ -1032,137 +1810,112 @@ int fs_init(void** instance, const char* omni_path, const char* config_path) {
 
     inst->blocks_offset = static_cast<uint32_t>(inst->bitmap_offset + bitmap_byte_count);
 
-    rebuild_path_index(inst);
+    rebuild_path_tree(inst);
+    inst->raw_fd = open(omni_path, O_RDONLY | O_CLOEXEC);
+    SimpleConfig cfg;
+    if (config_path) cfg.load(config_path);
+    if (!inst->io.open(omni_path, cfg.io_engine != "sync")) {
+        delete inst;
+        return ofs_err(OFSErrorCodes::ERROR_IO_ERROR);
+    }
 
     *instance = inst;
     g_fsinstance = inst;
     return ofs_success();}
 
-static std::vector<uint32_t> get_block_chain(FSInstance* inst, uint32_t start_index) {
-    std::vector<uint32_t> chain;
-    if (!inst || start_index == 0) return chain;
-    uint32_t cur = start_index;
-    while (cur != 0) {
-        chain.push_back(cur);
-        uint32_t next = 0;
-        std::vector<uint8_t> payload;
-        if (!read_block(inst->file, inst->blocks_offset, static_cast<uint32_t>(inst->header.block_size), cur, next, payload)) {
-            break;
-        }
-        cur = next;
-        if (chain.size() > inst->num_blocks + 2) break;
-    }
-    return chain;
-}
-int file_truncate(void* session, const char* path_c, size_t new_size) {
-    if (!session || !path_c) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
-    SessionInfo* s = reinterpret_cast<SessionInfo*>(session);
-    FSInstance* inst = s->inst;
-    if (!inst) return ofs_err(OFSErrorCodes::ERROR_INVALID_SESSION);
-    std::string path(path_c);
-    const uint32_t* pMeta = inst->path_index.find(path);
-    if (!pMeta) return ofs_err(OFSErrorCodes::ERROR_NOT_FOUND);
-    uint32_t meta_idx = *pMeta;
+static int truncate_entry(FSInstance* inst, uint32_t meta_idx, size_t new_size) {
     if (meta_idx == 0 || meta_idx > inst->meta_entries.size()) return ofs_err(OFSErrorCodes::ERROR_NOT_FOUND);
     MetaEntry& entry = inst->meta_entries[meta_idx - 1];
     if (entry.valid != 0) return ofs_err(OFSErrorCodes::ERROR_NOT_FOUND);
     if (entry.type != 0) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION); // not a file
+    bump_generation(inst, meta_idx);
     uint32_t block_payload = static_cast<uint32_t>(inst->header.block_size - 4);
-    uint32_t required_blocks = (new_size == 0) ? 0 : static_cast<uint32_t>((new_size + block_payload - 1) / block_payload);
-    std::vector<uint32_t> chain = get_block_chain(inst, entry.start_index);
-    uint32_t current_blocks = static_cast<uint32_t>(chain.size());
-    if (required_blocks == current_blocks) {
-        entry.total_size = new_size;
-        entry.modified_time = (uint64_t)time(nullptr);
-        persist_meta_entries(inst);
-        persist_header(inst);
-        return ofs_success();
-    }
-
+    uint32_t required_blocks = blocks_for_size(inst, new_size);
+    uint32_t current_blocks = chain_blocks(inst, entry);
     if (required_blocks < current_blocks) {
+        std::vector<uint32_t> chain = get_block_chain(inst, entry.start_index, current_blocks);
+        if (chain.size() < current_blocks) return ofs_err(OFSErrorCodes::ERROR_IO_ERROR);
         if (required_blocks == 0) {
             free_blocks(inst, chain);
             entry.start_index = 0;
         } else {
             std::vector<uint32_t> to_free(chain.begin() + required_blocks, chain.end());
             free_blocks(inst, to_free);
-            uint32_t last_keep = chain[required_blocks - 1];
-            uint64_t pos = (uint64_t)inst->blocks_offset + uint64_t(last_keep - 1) * inst->header.block_size;
-            inst->file.seekp(pos, std::ios::beg);
             uint32_t zero = 0;
-            inst->file.write(reinterpret_cast<const char*>(&zero), sizeof(zero));
-            inst->file.flush();
+            inst->io.add_write(block_pos(inst, chain[required_blocks - 1]), &zero, sizeof(zero));
+            if (!inst->io.submit()) return ofs_err(OFSErrorCodes::ERROR_IO_ERROR);
         }
         entry.total_size = new_size;
-        entry.modified_time = (uint64_t)time(nullptr);
+        entry.hole_blocks = 0;
+        touch_contents(entry);
         persist_meta_entries(inst);
         persist_bitmap(inst);
         persist_header(inst);
         return ofs_success();
     }
-    uint32_t need = required_blocks - current_blocks;
-    std::vector<uint32_t> newblocks = allocate_blocks(inst, need);
-    if (newblocks.size() != need) {
-        return ofs_err(OFSErrorCodes::ERROR_NO_SPACE);
-    }
-    if (current_blocks == 0) {
-        entry.start_index = newblocks[0];
-    } else {
-        uint32_t last = chain.back();
-        uint64_t pos = (uint64_t)inst->blocks_offset + uint64_t(last - 1) * inst->header.block_size;
-        inst->file.seekp(pos, std::ios::beg);
-        uint32_t next_idx = newblocks[0];
-        inst->file.write(reinterpret_cast<const char*>(&next_idx), sizeof(next_idx));
-        inst->file.flush();
-    }
-    for (size_t i = 0; i < newblocks.size(); ++i) {
-        uint32_t blk = newblocks[i];
-        uint32_t next = (i + 1 < newblocks.size()) ? newblocks[i + 1] : 0;
-        if (!write_block(inst->file, inst->blocks_offset, static_cast<uint32_t>(inst->header.block_size), blk, next, nullptr, 0)) {
-            free_blocks(inst, newblocks);
-            return ofs_err(OFSErrorCodes::ERROR_IO_ERROR);
-        }
+    // Growing allocates nothing: blocks past the chain become holes until first written.
+    // Only the stale bytes between the old end and the end of its block are cleared.
+    uint64_t stored_end = uint64_t(current_blocks) * block_payload;
+    if (new_size > entry.total_size && entry.total_size < stored_end) {
+        std::vector<uint32_t> chain = get_block_chain(inst, entry.start_index, current_blocks);
+        if (chain.size() < current_blocks) return ofs_err(OFSErrorCodes::ERROR_IO_ERROR);
+        size_t in_block = static_cast<size_t>(entry.total_size % block_payload);
+        std::vector<uint8_t> zeros(block_payload - in_block, 0), enc;
+        encode_data(inst, zeros.data(), zeros.size(), enc);
+        inst->io.add_write(block_pos(inst, chain.back()) + 4 + in_block, enc.data(), enc.size());
+        if (!inst->io.submit()) return ofs_err(OFSErrorCodes::ERROR_IO_ERROR);
     }
-
     entry.total_size = new_size;
-    entry.modified_time = (uint64_t)time(nullptr);
+    entry.hole_blocks = required_blocks - current_blocks;
+    touch_contents(entry);
     if (inst->next_meta_index <= meta_idx) inst->next_meta_index = meta_idx + 1;
     persist_meta_entries(inst);
-    persist_bitmap(inst);
     persist_header(inst);
     return ofs_success();
 }
+int file_truncate(void* session, const char* path_c, size_t new_size) {
+    if (!session || !path_c) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    SessionInfo* s = session_of(session);
+    if (!s) return ofs_err(OFSErrorCodes::ERROR_INVALID_SESSION);
+    FSInstance* inst = s->inst;
+    std::lock_guard<std::recursive_mutex> lock(inst->mtx);
+    session_touch_locked(s);
+    uint32_t pMeta = inst->path_tree.resolve(path_c);
+    if (!pMeta) return ofs_err(OFSErrorCodes::ERROR_NOT_FOUND);
+    int r = truncate_entry(inst, pMeta, new_size);
+    if (r == ofs_success()) notify_watches(inst, OFSWatchEventType::MODIFY, pMeta);
+    return r;
+}
 int file_exists(void* session, const char* path_c) {
     if (!session || !path_c) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
-    SessionInfo* s = reinterpret_cast<SessionInfo*>(session);
+    SessionInfo* s = session_of(session);
+    if (!s) return ofs_err(OFSErrorCodes::ERROR_INVALID_SESSION);
     FSInstance* inst = s->inst;
-    if (!inst) return ofs_err(OFSErrorCodes::ERROR_INVALID_SESSION);
+    std::lock_guard<std::recursive_mutex> lock(inst->mtx);
+    session_touch_locked(s);
     std::string path(path_c);
-    const uint32_t* pm = inst->path_index.find(path);
+    uint32_t pm = inst->path_tree.resolve(path);
     if (!pm) return ofs_err(OFSErrorCodes::ERROR_NOT_FOUND);
-    uint32_t meta_idx = *pm;
+    uint32_t meta_idx = pm;
     if (meta_idx == 0 || meta_idx > inst->meta_entries.size()) return ofs_err(OFSErrorCodes::ERROR_NOT_FOUND);
     const MetaEntry& me = inst->meta_entries[meta_idx - 1];
     if (me.valid != 0) return ofs_err(OFSErrorCodes::ERROR_NOT_FOUND);
     if (me.type != 0) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION); 
     return ofs_success();
 }
-int file_rename(void* session, const char* old_path_c, const char* new_path_c) {
-    if (!session || !old_path_c || !new_path_c) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
-    SessionInfo* s = reinterpret_cast<SessionInfo*>(session);
+static int file_rename_locked(SessionInfo* s, const char* old_path_c, const char* new_path_c) {
     FSInstance* inst = s->inst;
-    if (!inst) return ofs_err(OFSErrorCodes::ERROR_INVALID_SESSION);
-
     std::string old_path(old_path_c);
     std::string new_path(new_path_c);
     if (old_path.empty() || new_path.empty()) return ofs_err(OFSErrorCodes::ERROR_INVALID_PATH);
-    const uint32_t* old_meta_p = inst->path_index.find(old_path);
+    uint32_t old_meta_p = inst->path_tree.resolve(old_path);
     if (!old_meta_p) return ofs_err(OFSErrorCodes::ERROR_NOT_FOUND);
-    uint32_t old_meta_idx = *old_meta_p;
+    uint32_t old_meta_idx = old_meta_p;
     if (old_meta_idx == 0 || old_meta_idx > inst->meta_entries.size()) return ofs_err(OFSErrorCodes::ERROR_NOT_FOUND);
     MetaEntry& entry = inst->meta_entries[old_meta_idx - 1];
     if (entry.valid != 0) return ofs_err(OFSErrorCodes::ERROR_NOT_FOUND);
-    if (inst->path_index.contains(new_path)) return ofs_err(OFSErrorCodes::ERROR_FILE_EXISTS);
+    bump_generation(inst, old_meta_idx);
+    if (inst->path_tree.resolve(new_path)) return ofs_err(OFSErrorCodes::ERROR_FILE_EXISTS);
     std::string::size_type pos = new_path.find_last_of('/');
     std::string new_basename;
     std::string new_parent_path;
@@ -1178,31 +1931,325 @@ int file_rename(void* session, const char* old_path_c, const char* new_path_c) {
     if (new_basename.empty() || new_basename.size() > sizeof(entry.name) - 1) {
         return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
     }
-    const uint32_t* new_parent_meta_p = inst->path_index.find(new_parent_path);
+    uint32_t new_parent_meta_p = inst->path_tree.resolve(new_parent_path);
     if (!new_parent_meta_p) return ofs_err(OFSErrorCodes::ERROR_NOT_FOUND);
-    uint32_t new_parent_idx = *new_parent_meta_p;
+    uint32_t new_parent_idx = new_parent_meta_p;
     if (new_parent_idx == 0 || new_parent_idx > inst->meta_entries.size()) return ofs_err(OFSErrorCodes::ERROR_NOT_FOUND);
     MetaEntry& new_parent = inst->meta_entries[new_parent_idx - 1];
     if (new_parent.valid != 0 || new_parent.type != 1) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    // A directory cannot move below itself.
+    for (uint32_t up = new_parent_idx; up; up = inst->path_tree.parent(up))
+        if (up == old_meta_idx) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
     uint32_t old_parent_idx = entry.parent;
     if (old_parent_idx == 0 || old_parent_idx > inst->meta_entries.size()) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
     MetaEntry& old_parent = inst->meta_entries[old_parent_idx - 1];
+    std::string moved_from = inst->watch_count ? build_full_path_from_meta(inst, old_meta_idx) : std::string();
     if (!dir_remove_child(inst, old_parent, old_meta_idx)) {
         return ofs_err(OFSErrorCodes::ERROR_IO_ERROR);
     }
+    std::string old_name = entry.get_name();
     entry.set_name(new_basename);
     entry.parent = new_parent_idx;
     entry.modified_time = (uint64_t)time(nullptr);
     if (!dir_add_child(inst, new_parent, old_meta_idx)) {
-        entry.set_name(entry.get_name().c_str());
+        entry.set_name(old_name);
         entry.parent = old_parent_idx;
         dir_add_child(inst, old_parent, old_meta_idx);
         return ofs_err(OFSErrorCodes::ERROR_IO_ERROR);
     }
+    // Descendants hang off the node itself, so moving a directory relinks just this node.
+    inst->path_tree.unlink(old_parent_idx, old_name);
+    inst->path_tree.link(new_parent_idx, new_basename, old_meta_idx);
+    bump_generation(inst, old_meta_idx);   // again, now that the new parent's listing changed
     persist_meta_entries(inst);
     persist_header(inst);
-    rebuild_path_index(inst);
+    notify_watches(inst, OFSWatchEventType::RENAME, old_meta_idx, moved_from.c_str(), old_parent_idx);
     return ofs_success();
 }
+int file_rename(void* session, const char* old_path_c, const char* new_path_c) {
+    if (!session || !old_path_c || !new_path_c) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    SessionInfo* s = session_of(session);
+    if (!s) return ofs_err(OFSErrorCodes::ERROR_INVALID_SESSION);
+    std::lock_guard<std::recursive_mutex> lock(s->inst->mtx);
+    session_touch_locked(s);
+    return file_rename_locked(s, old_path_c, new_path_c);
+}
+int fs_batch(void* session, OFSBatchOp* ops, int count) {
+    if (!session || (!ops && count > 0) || count < 0) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    SessionInfo* s = session_of(session);
+    if (!s) return ofs_err(OFSErrorCodes::ERROR_INVALID_SESSION);
+    FSInstance* inst = s->inst;
+    std::lock_guard<std::recursive_mutex> lock(inst->mtx);
+    session_touch_locked(s);
+    // Each operation updates the in-memory tables as usual; the metadata, bitmap and header
+    // regions they touch are written once at the end instead of once per operation.
+    inst->defer_persist = true;
+    inst->dirty = 0;
+    for (int i = 0; i < count; ++i) {
+        OFSBatchOp& op = ops[i];
+        if (!op.path) { op.result = ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION); continue; }
+        switch (op.type) {
+        case OFSBatchOpType::CREATE_FILE: op.result = file_create_locked(s, op.path, op.arg, op.arg ? op.size : 0); break;
+        case OFSBatchOpType::DELETE_FILE: op.result = file_delete_locked(s, op.path); break;
+        case OFSBatchOpType::RENAME:
+            op.result = op.arg ? file_rename_locked(s, op.path, op.arg) : ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
+            break;
+        case OFSBatchOpType::CREATE_DIR: op.result = dir_create_locked(s, op.path); break;
+        case OFSBatchOpType::DELETE_DIR: op.result = dir_delete_locked(s, op.path); break;
+        case OFSBatchOpType::SET_PERMISSIONS: op.result = set_permissions_locked(s, op.path, op.permissions); break;
+        default: op.result = ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION); break;
+        }
+    }
+    inst->defer_persist = false;
+    bool ok = true;
+    if (inst->dirty & DIRTY_META) ok = persist_meta_entries(inst) && ok;
+    if (inst->dirty & DIRTY_BITMAP) ok = persist_bitmap(inst) && ok;
+    if (inst->dirty & DIRTY_HEADER) ok = persist_header(inst) && ok;
+    inst->dirty = 0;
+    return ok ? ofs_success() : ofs_err(OFSErrorCodes::ERROR_IO_ERROR);
+}
+
 
 
+// Open file: the entry it was opened on and a cached copy of its block chain. The chain is
+// reloaded only when the entry's generation has moved since it was read.
+struct FileHandle {
+    SessionInfo* session;
+    uint32_t meta_index;
+    uint32_t incarnation;           // of the entry at open; a deleted file's slot may be reused
+    uint64_t generation;            // of the entry when `blocks` was read
+    std::vector<uint32_t> blocks;
+    uint64_t map_generation;        // of the entry at the last handle_map_extents
+    int map_count;                  // extents in that map
+    FSInstance* inst;
+    std::vector<uint32_t> pinned;   // blocks of a zero-copy map, held until file_close
+};
+// Caller holds inst->mtx.
+static int handle_refresh(FileHandle* h, MetaEntry*& entry) {
+    FSInstance* inst = h->session->inst;
+    entry = &inst->meta_entries[h->meta_index - 1];
+    if (entry->valid != 0 || entry->type != 0 || inst->incarnations[h->meta_index - 1] != h->incarnation)
+        return ofs_err(OFSErrorCodes::ERROR_NOT_FOUND);
+    uint64_t g = inst->generations[h->meta_index - 1];
+    if (g != h->generation) {
+        h->blocks = get_block_chain(inst, entry->start_index, chain_blocks(inst, *entry));
+        if (h->blocks.size() < chain_blocks(inst, *entry)) return ofs_err(OFSErrorCodes::ERROR_IO_ERROR);
+        h->generation = g;
+    }
+    return ofs_success();
+}
+// Queues one read or write per block touched by [offset, offset + len) of the file's payload.
+static void handle_queue_range(FSInstance* inst, const FileHandle* h, uint64_t offset, uint8_t* buf, size_t len, bool write) {
+    const uint64_t payload = inst->header.block_size - 4;
+    while (len > 0) {
+        size_t bi = static_cast<size_t>(offset / payload);
+        uint64_t in_block = offset % payload;
+        size_t n = static_cast<size_t>(std::min<uint64_t>(len, payload - in_block));
+        uint64_t pos = block_pos(inst, h->blocks[bi]) + 4 + in_block;
+        if (write) inst->io.add_write(pos, buf, n);
+        else inst->io.add_read(pos, buf, n);
+        offset += n;
+        buf += n;
+        len -= n;
+    }
+}
+int file_open(void* session, const char* path_c, void** handle) {
+    if (!session || !path_c || !handle) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    SessionInfo* s = session_of(session);
+    if (!s) return ofs_err(OFSErrorCodes::ERROR_INVALID_SESSION);
+    FSInstance* inst = s->inst;
+    std::lock_guard<std::recursive_mutex> lock(inst->mtx);
+    session_touch_locked(s);
+    uint32_t meta_idx = inst->path_tree.resolve(path_c);
+    if (!meta_idx) return ofs_err(OFSErrorCodes::ERROR_NOT_FOUND);
+    const MetaEntry& me = inst->meta_entries[meta_idx - 1];
+    if (me.valid != 0) return ofs_err(OFSErrorCodes::ERROR_NOT_FOUND);
+    if (me.type != 0) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    FileHandle* h = new FileHandle{s, meta_idx, inst->incarnations[meta_idx - 1], 0, {}, 0, 0, inst, {}};
+    MetaEntry* entry = nullptr;
+    int r = handle_refresh(h, entry);
+    if (r != ofs_success()) { delete h; return r; }
+    *handle = h;
+    return ofs_success();
+}
+int handle_read(void* handle, uint64_t offset, size_t size, char* buffer, size_t* read_out) {
+    if (!handle || (!buffer && size > 0) || !read_out) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    FileHandle* h = reinterpret_cast<FileHandle*>(handle);
+    SessionInfo* s = session_of(h->session);
+    if (!s) return ofs_err(OFSErrorCodes::ERROR_INVALID_SESSION);
+    FSInstance* inst = s->inst;
+    std::lock_guard<std::recursive_mutex> lock(inst->mtx);
+    session_touch_locked(s);
+    MetaEntry* entry = nullptr;
+    int r = handle_refresh(h, entry);
+    if (r != ofs_success()) return r;
+    *read_out = 0;
+    if (offset >= entry->total_size) return ofs_success();
+    size_t n = static_cast<size_t>(std::min<uint64_t>(size, entry->total_size - offset));
+    // Bytes past the chain are holes: zeros, with nothing to read.
+    uint64_t stored_end = uint64_t(h->blocks.size()) * (inst->header.block_size - 4);
+    size_t stored = offset < stored_end ? static_cast<size_t>(std::min<uint64_t>(n, stored_end - offset)) : 0;
+    handle_queue_range(inst, h, offset, reinterpret_cast<uint8_t*>(buffer), stored, false);
+    if (!inst->io.submit()) return ofs_err(OFSErrorCodes::ERROR_IO_ERROR);
+    if (encoding_initialized(inst)) {
+        std::vector<uint8_t> dec;
+        decode_data(inst, reinterpret_cast<const uint8_t*>(buffer), stored, dec);
+        std::memcpy(buffer, dec.data(), stored);
+    }
+    std::memset(buffer + stored, 0, n - stored);
+    *read_out = n;
+    return ofs_success();
+}
+int handle_write(void* handle, uint64_t offset, const char* data, size_t size) {
+    if (!handle || (!data && size > 0)) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    FileHandle* h = reinterpret_cast<FileHandle*>(handle);
+    SessionInfo* s = session_of(h->session);
+    if (!s) return ofs_err(OFSErrorCodes::ERROR_INVALID_SESSION);
+    FSInstance* inst = s->inst;
+    std::lock_guard<std::recursive_mutex> lock(inst->mtx);
+    session_touch_locked(s);
+    MetaEntry* entry = nullptr;
+    int r = handle_refresh(h, entry);
+    if (r != ofs_success()) return r;
+    if (offset + size > entry->total_size) {
+        r = truncate_entry(inst, h->meta_index, static_cast<size_t>(offset + size));
+        if (r == ofs_success()) r = handle_refresh(h, entry);
+        if (r != ofs_success()) return r;
+    }
+    std::vector<uint8_t> enc;
+    encode_data(inst, reinterpret_cast<const uint8_t*>(data), size, enc);
+    // The part that lands in holes goes out with the blocks that fill them.
+    uint64_t stored_end = uint64_t(h->blocks.size()) * (inst->header.block_size - 4);
+    bool filled = false;
+    if (offset + size > stored_end) {
+        std::vector<uint32_t> added;
+        r = fill_holes(inst, *entry, h->blocks.empty() ? 0 : h->blocks.back(), offset, offset + size, enc.data(), added);
+        if (r != ofs_success()) return r;
+        h->blocks.insert(h->blocks.end(), added.begin(), added.end());
+        filled = !added.empty();
+    }
+    size_t stored = offset < stored_end ? static_cast<size_t>(std::min<uint64_t>(size, stored_end - offset)) : 0;
+    handle_queue_range(inst, h, offset, enc.data(), stored, true);
+    if (!inst->io.submit()) return ofs_err(OFSErrorCodes::ERROR_IO_ERROR);
+    bump_generation(inst, h->meta_index);
+    h->generation = inst->generations[h->meta_index - 1];   // `blocks` is up to date
+    touch_contents(*entry);
+    persist_meta_entries(inst);
+    if (filled) {
+        persist_bitmap(inst);
+        persist_header(inst);
+    }
+    notify_watches(inst, OFSWatchEventType::MODIFY, h->meta_index);
+    return ofs_success();
+}
+int handle_stat(void* handle, FileMetadata* meta) {
+    if (!handle || !meta) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    FileHandle* h = reinterpret_cast<FileHandle*>(handle);
+    SessionInfo* s = session_of(h->session);
+    if (!s) return ofs_err(OFSErrorCodes::ERROR_INVALID_SESSION);
+    FSInstance* inst = s->inst;
+    std::lock_guard<std::recursive_mutex> lock(inst->mtx);
+    session_touch_locked(s);
+    MetaEntry* entry = nullptr;
+    int r = handle_refresh(h, entry);
+    if (r != ofs_success()) return r;
+    fill_metadata(inst, h->meta_index, build_full_path_from_meta(inst, h->meta_index),
+                  static_cast<uint32_t>(h->blocks.size()), meta);
+    return ofs_success();
+}
+int handle_map_extents(void* handle, OFSExtent** extents, int* count, size_t* size_out, int* raw_fd) {
+    if (!handle || !extents || !count || !size_out) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    FileHandle* h = reinterpret_cast<FileHandle*>(handle);
+    SessionInfo* s = session_of(h->session);
+    if (!s) return ofs_err(OFSErrorCodes::ERROR_INVALID_SESSION);
+    FSInstance* inst = s->inst;
+    std::lock_guard<std::recursive_mutex> lock(inst->mtx);
+    session_touch_locked(s);
+    MetaEntry* entry = nullptr;
+    int r = handle_refresh(h, entry);
+    if (r != ofs_success()) return r;
+    const uint64_t payload = inst->header.block_size - 4;
+    uint32_t n = blocks_for_size(inst, entry->total_size);
+    std::vector<OFSExtent> out(n);
+    for (uint32_t i = 0; i < n; ++i) {
+        out[i].offset = i < h->blocks.size() ? block_pos(inst, h->blocks[i]) + 4 : 0;
+        out[i].length = std::min<uint64_t>(payload, entry->total_size - uint64_t(i) * payload);
+    }
+    *extents = nullptr;
+    if (!out.empty()) {
+        *extents = (OFSExtent*)malloc(out.size() * sizeof(OFSExtent));
+        if (!*extents) return ofs_err(OFSErrorCodes::ERROR_NO_SPACE);
+        std::memcpy(*extents, out.data(), out.size() * sizeof(OFSExtent));
+    }
+    *count = static_cast<int>(n);
+    *size_out = static_cast<size_t>(entry->total_size);
+    h->map_generation = h->generation;
+    h->map_count = static_cast<int>(n);
+    // Ranges may be sent straight from the container only when bytes are stored as-is. They
+    // are read after the lock is released, so the blocks stay out of allocation until close.
+    if (raw_fd) {
+        *raw_fd = encoding_initialized(inst) ? -1 : inst->raw_fd;
+        release_blocks(inst, h->pinned);
+        h->pinned.clear();
+        if (*raw_fd >= 0) {
+            h->pinned = h->blocks;
+            hold_blocks(inst, h->pinned);
+        }
+    }
+    return ofs_success();
+}
+// Caller holds inst->mtx.
+static bool handle_map_current(const FSInstance* inst, const FileHandle* h) {
+    const MetaEntry& entry = inst->meta_entries[h->meta_index - 1];
+    return entry.valid == 0 && entry.type == 0 && inst->incarnations[h->meta_index - 1] == h->incarnation &&
+           inst->generations[h->meta_index - 1] == h->map_generation && h->generation == h->map_generation;
+}
+int handle_check_extents(void* handle) {
+    if (!handle) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    FileHandle* h = reinterpret_cast<FileHandle*>(handle);
+    std::lock_guard<std::recursive_mutex> lock(h->inst->mtx);
+    return handle_map_current(h->inst, h) ? ofs_success() : ofs_err(OFSErrorCodes::ERROR_FILE_CHANGED);
+}
+int handle_read_extents(void* handle, int first, int count, char* buffer) {
+    if (!handle || !buffer || first < 0 || count < 0) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    FileHandle* h = reinterpret_cast<FileHandle*>(handle);
+    SessionInfo* s = session_of(h->session);
+    if (!s) return ofs_err(OFSErrorCodes::ERROR_INVALID_SESSION);
+    FSInstance* inst = s->inst;
+    std::lock_guard<std::recursive_mutex> lock(inst->mtx);
+    session_touch_locked(s);
+    if (count > h->map_count - first) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    // The map's block list is only valid while the file is the one it was made for, unchanged.
+    if (!handle_map_current(inst, h)) return ofs_err(OFSErrorCodes::ERROR_FILE_CHANGED);
+    const MetaEntry& entry = inst->meta_entries[h->meta_index - 1];
+    // One batch for the whole window; extents of adjacent blocks merge into single reads.
+    const uint64_t payload = inst->header.block_size - 4;
+    char* out = buffer;
+    size_t stored = 0;
+    for (int i = first; i < first + count; ++i) {
+        size_t len = static_cast<size_t>(std::min<uint64_t>(payload, entry.total_size - uint64_t(i) * payload));
+        if (size_t(i) < h->blocks.size()) {
+            inst->io.add_read(block_pos(inst, h->blocks[i]) + 4, out, len);
+            stored += len;
+        } else {
+            std::memset(out, 0, len);
+        }
+        out += len;
+    }
+    if (!inst->io.submit()) return ofs_err(OFSErrorCodes::ERROR_IO_ERROR);
+    // Stored extents come before the holes, so the bytes to decode are one prefix.
+    if (encoding_initialized(inst)) {
+        std::vector<uint8_t> dec;
+        decode_data(inst, reinterpret_cast<const uint8_t*>(buffer), stored, dec);
+        std::memcpy(buffer, dec.data(), stored);
+    }
+    return ofs_success();
+}
+int file_close(void* handle) {
+    if (!handle) return ofs_err(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    FileHandle* h = reinterpret_cast<FileHandle*>(handle);
+    // Only the hold table is touched, so a handle may be closed while mtx is held elsewhere.
+    release_blocks(h->inst, h->pinned);
+    delete h;
+    return ofs_success();
+}
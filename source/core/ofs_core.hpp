@@ -7,6 +7,12 @@ extern "C" {
 int fs_format(const char* omni_path, const char* config_path);
 int fs_init(void** instance, const char* omni_path, const char* config_path);
 int fs_shutdown(void* instance);
+// Block I/O engine the instance ended up with: "io_uring" or "sync".
+const char* fs_io_engine(void* instance);
+// Takes the instance lock only if it is free (1) instead of waiting (0). Until fs_unlock,
+// API calls from the same thread go ahead and those from other threads wait.
+int fs_try_lock(void* instance);
+void fs_unlock(void* instance);
 int user_login(void** session, const char* username, const char* password);
 int user_logout(void* session);
 int user_create(void* admin_session, const char* username, const char* password, UserRole role);
@@ -15,17 +21,88 @@ int user_list(void* admin_session, UserInfo** users_out, int* count);
 int get_session_info(void* session, SessionInfo* info);
 int file_create(void* session, const char* path, const char* data, size_t size);
 int file_read(void* session, const char* path, char** buffer, size_t* size_out);
+// file_read that also returns the file's version tag. When if_tag is non-null and equals
+// the current tag nothing is read: *buffer is null and *size_out is 0.
+int file_read_tagged(void* session, const char* path, const OFSVersionTag* if_tag,
+                     char** buffer, size_t* size_out, OFSVersionTag* tag_out);
+int file_upload_begin(void* session, const char* path, void** upload);
+int file_upload_write(void* upload, const char* data, size_t size);
+int file_upload_commit(void* upload);
+int file_upload_abort(void* upload);
 int file_edit(void* session, const char* path, const char* data, size_t size, unsigned int index);
 int file_delete(void* session, const char* path);
 int file_truncate(void* session, const char* path, size_t new_size);
 int file_exists(void* session, const char* path);
 int file_rename(void* session, const char* old_path, const char* new_path);
+// Runs ops in order under one lock and persists the metadata they change once, at the end.
+// Each op's code is stored in its `result`; the return value only reports that final write.
+int fs_batch(void* session, OFSBatchOp* ops, int count);
 int dir_create(void* session, const char* path);
 int dir_list(void* session, const char* path, FileEntry** entries, int* count);
+// One page of a directory listing, in name order: up to limit children whose names sort
+// after `after` (the cursor returned for the previous page; null or "" starts at the top).
+// *next_cursor is null on the last page; free it and the entries with free_buffer.
+// dir_list_names returns only names and types.
+int dir_list_page(void* session, const char* path, const char* after, int limit,
+                  FileEntry** entries, int* count, char** next_cursor);
+int dir_list_names(void* session, const char* path, const char* after, int limit,
+                   OFSNameEntry** entries, int* count, char** next_cursor);
 int dir_delete(void* session, const char* path);
+// Recursive forms of dir_delete and a directory copy. Each handles the whole subtree in one
+// pass under the lock and writes the metadata and bitmap once. The copy reserves all entries
+// and blocks up front, so it fails with ERROR_NO_SPACE before writing anything; dst must not
+// exist or lie inside src, and the copied entries belong to the caller.
+int dir_delete_tree(void* session, const char* path);
+int dir_copy_tree(void* session, const char* src, const char* dst);
+// Entries of the directory part of prefix whose names start with its last component
+// ("/docs/re" matches /docs/report, /docs/readme), in name order; with subtree, everything
+// below each match follows it. FileEntry::name holds the full path. Free with free_buffer.
+int path_prefix_scan(void* session, const char* prefix, int subtree, FileEntry** entries, int* count);
+// Walks everything below root in path_prefix_scan's subtree order and returns up to limit
+// entries matching filter (FileEntry::name holds the full path). A call also stops after
+// visiting 65536 entries, even with fewer matches, so the filesystem lock is only held
+// briefly; pass the returned *next_cursor back as cursor to continue. *next_cursor is
+// null once the walk is complete; free it and entries with free_buffer.
+int fs_find(void* session, const char* root, const OFSFindFilter* filter, const char* cursor, int limit,
+            FileEntry** entries, int* count, char** next_cursor);
 int dir_exists(void* session, const char* path);
+// Change notification: cb is called for creates, deletes, renames and modifications of path
+// itself and its direct children, or with subtree of anything below it. It runs on the thread
+// making the change with the filesystem lock held, so it must be quick and must not call
+// back into this API. A watch follows its entry across renames; once the entry is deleted
+// it gets that DELETE event and no more. After fs_watch_remove returns, cb is not running
+// and will not be called again.
+int fs_watch_add(void* session, const char* path, int subtree, OFSWatchCallback cb, void* ctx, void** watch);
+int fs_watch_remove(void* watch);
+// Handle API: file_open resolves the path once and caches the file's block chain; the
+// handle_* calls then address the file by handle and byte offset. A handle follows the file
+// across renames and fails with ERROR_NOT_FOUND once it is deleted. handle_write may extend
+// the file; a write past the end leaves a hole that reads as zeros. Not thread-safe per handle.
+int file_open(void* session, const char* path, void** handle);
+int handle_read(void* handle, uint64_t offset, size_t size, char* buffer, size_t* read_out);
+int handle_write(void* handle, uint64_t offset, const char* data, size_t size);
+int handle_stat(void* handle, FileMetadata* meta);
+int file_close(void* handle);
+// Maps an open file for a windowed transfer: one extent per block of its current contents.
+// handle_read_extents then reads extents [first, first + count) of that map into buffer,
+// under the lock, and fails with ERROR_FILE_CHANGED once the file has been written,
+// truncated, renamed, deleted or otherwise changed since the map was made, so a transfer
+// never mixes versions or returns blocks the file no longer owns.
+// If raw_fd is given and the volume stores bytes unencoded, *raw_fd is a descriptor on the
+// container from which the extents may be sent directly (otherwise -1). Their blocks are
+// then not reused until file_close, even if the file is deleted or truncated; check each
+// window with handle_check_extents before sending it.
+int handle_map_extents(void* handle, OFSExtent** extents, int* count, size_t* size_out, int* raw_fd);
+int handle_read_extents(void* handle, int first, int count, char* buffer);
+// SUCCESS while the file is unchanged since handle_map_extents, else ERROR_FILE_CHANGED.
+int handle_check_extents(void* handle);
 int get_metadata(void* session, const char* path, FileMetadata* meta);
+// Inode and change generation of path; the generation moves whenever the entry or,
+// for a directory, any of its children changes.
+int get_generation(void* session, const char* path, uint32_t* inode, uint64_t* generation);
 int set_permissions(void* session, const char* path, uint32_t permissions);
+// Gives path to another existing user. Admin only.
+int set_owner(void* session, const char* path, const char* username);
 int get_stats(void* session, FSStats* stats);
 void free_buffer(void* buffer);
 const char* get_error_message(int error_code);
@@ -4,25 +4,41 @@
 #include <vector>
 #include <string>
 #include <memory>
+#include <mutex>
 #include <cstdint>
 #include "../include/ofs_types.hpp"
 #include "../data_structures/simple_unordered_map.hpp"
 #include "meta_entry.hpp"
+#include "block_io.hpp"
+#include "../data_structures/namespace_tree.hpp"
+
+struct FSWatch;
 
 struct FSInstance {
     OMNIHeader header;
     std::string omni_path;
     std::fstream file;
+    int raw_fd;   // read-only descriptor on the container, used for zero-copy transfers
+    BlockIO io;   // batched block reads/writes; metadata regions still go through `file`
+    std::recursive_mutex mtx;   // serializes API calls; taken by every public function that touches the instance,
+                                // recursive so an fs_try_lock holder can make them
 
     std::vector<UserInfo> users;
     SimpleHashMap<size_t> user_index;
     std::vector<MetaEntry> meta_entries;
     std::vector<uint8_t> free_bitmap;
+    std::mutex holds_mtx;                 // guards block_holds; may be taken under mtx, never the other way
+    std::vector<uint32_t> block_holds;    // per block, see hold_blocks; sized on first use
+    std::vector<uint64_t> generations;   // per meta entry, see bump_generation
+    std::vector<uint32_t> incarnations;  // per meta entry, bumped when a file entry is freed (see file_open)
+    uint64_t generation_clock = 0;
 
     uint8_t encoding_map[256];
     uint8_t private_key[64];
 
-    SimpleHashMap<uint32_t> path_index;
+    NamespaceTree path_tree;   // meta index by directory and name; node numbers are meta indices
+    std::vector<std::vector<FSWatch*>> watches;   // per meta entry, from fs_watch_add; sized on first use
+    size_t watch_count = 0;
     SimpleHashMap<std::shared_ptr<SessionInfo>> sessions;
 
     uint32_t max_files;
@@ -31,9 +47,11 @@ struct FSInstance {
     uint32_t bitmap_offset;
     uint32_t metadata_offset;
     uint64_t next_meta_index;
+    bool defer_persist = false;   // set during fs_batch: persist_* only record the region in `dirty`
+    uint8_t dirty = 0;
 
     FSInstance(uint32_t max_users_hint = 101)
-        : user_index(101), path_index(1009), sessions(409),
+        : raw_fd(-1), user_index(101), sessions(409),
           max_files(0), num_blocks(0),
           blocks_offset(0), bitmap_offset(0), metadata_offset(0), next_meta_index(2) {
         std::memset(encoding_map, 0, sizeof(encoding_map));
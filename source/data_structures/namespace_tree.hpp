@@ -0,0 +1,169 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
+
+// Directory tree keyed by node number (the meta index; 0 means "none"). Each directory
+// keeps its children sorted by name, so a lookup costs one binary search per path
+// component, a name prefix is a contiguous range, and moving a subtree is one unlink and
+// one link. Every name is stored once, in its parent's child list.
+class NamespaceTree {
+public:
+    explicit NamespaceTree(uint32_t root = 1) : root_(root) { reset(0); }
+
+    // Drops every link; nodes up to `capacity` can be linked without growing.
+    void reset(size_t capacity) {
+        nodes.assign(std::max<size_t>(capacity, root_) + 1, Node());
+        _size = 1;
+    }
+    uint32_t root() const { return root_; }
+    size_t size() const { return _size; }
+
+    // Links node under parent as name. False if parent already has a child of that name.
+    bool link(uint32_t parent, const std::string& name, uint32_t node) {
+        if (parent == 0 || node == 0 || node == root_) return false;
+        grow(std::max(parent, node));
+        auto& ch = nodes[parent].children;
+        auto it = lower(ch, name);
+        if (it != ch.end() && it->first == name) return false;
+        ch.insert(it, Child(name, node));
+        nodes[node].parent = parent;
+        ++_size;
+        return true;
+    }
+    // Removes name from parent's children; the node keeps its own children, so a
+    // subtree can be unlinked and linked again elsewhere.
+    uint32_t unlink(uint32_t parent, const std::string& name) {
+        if (parent >= nodes.size()) return 0;
+        auto& ch = nodes[parent].children;
+        auto it = lower(ch, name);
+        if (it == ch.end() || it->first != name) return 0;
+        uint32_t node = it->second;
+        ch.erase(it);
+        nodes[node].parent = 0;
+        --_size;
+        return node;
+    }
+    uint32_t lookup(uint32_t parent, const std::string& name) const {
+        if (parent >= nodes.size()) return 0;
+        const auto& ch = nodes[parent].children;
+        auto it = lower(ch, name);
+        return (it != ch.end() && it->first == name) ? it->second : 0;
+    }
+    // Walks an absolute path one component at a time ("//a/" is the same as "/a").
+    // Returns 0 if the path is relative or any component is missing.
+    uint32_t resolve(const std::string& path) const {
+        if (path.empty() || path[0] != '/') return 0;
+        uint32_t cur = root_;
+        size_t i = 0, n = path.size();
+        std::string part;
+        while (cur && i < n) {
+            while (i < n && path[i] == '/') ++i;
+            if (i >= n) break;
+            size_t j = path.find('/', i);
+            if (j == std::string::npos) j = n;
+            part.assign(path, i, j - i);
+            cur = lookup(cur, part);
+            i = j;
+        }
+        return cur;
+    }
+    uint32_t parent(uint32_t node) const { return node < nodes.size() ? nodes[node].parent : 0; }
+    bool has_children(uint32_t node) const { return node < nodes.size() && !nodes[node].children.empty(); }
+    size_t child_count(uint32_t node) const { return node < nodes.size() ? nodes[node].children.size() : 0; }
+
+    // Calls fn(name, node) for each child of dir whose name starts with prefix, in name
+    // order, until fn returns false.
+    template <typename Fn>
+    void scan(uint32_t dir, const std::string& prefix, Fn fn) const {
+        if (dir >= nodes.size()) return;
+        const auto& ch = nodes[dir].children;
+        for (auto it = lower(ch, prefix); it != ch.end(); ++it) {
+            if (it->first.compare(0, prefix.size(), prefix) != 0) break;
+            if (!fn(it->first, it->second)) return;
+        }
+    }
+    // Calls fn(name, node) for each child of dir whose name sorts after `after`, in name
+    // order, until fn returns false.
+    template <typename Fn>
+    void scan_after(uint32_t dir, const std::string& after, Fn fn) const {
+        if (dir >= nodes.size()) return;
+        const auto& ch = nodes[dir].children;
+        auto it = lower(ch, after);
+        if (it != ch.end() && it->first == after) ++it;
+        for (; it != ch.end(); ++it)
+            if (!fn(it->first, it->second)) return;
+    }
+    // Depth-first, pre-order walk of everything below dir, children in name order.
+    // fn(path, node) gets the path relative to dir ("a", "a/b", ...) and returns false to
+    // stop the walk. Returns false if it was stopped.
+    template <typename Fn>
+    bool walk(uint32_t dir, Fn fn) const {
+        std::string path;
+        return walk_from(dir, path, fn);
+    }
+    // Same walk, resumed after the node at relative path `after` (split into components):
+    // visits exactly the nodes a full walk would visit after it. The node itself need not
+    // exist any more.
+    template <typename Fn>
+    bool walk_after(uint32_t dir, const std::vector<std::string>& after, Fn fn) const {
+        std::string path;
+        return walk_after_from(dir, path, after, 0, fn);
+    }
+
+private:
+    using Child = std::pair<std::string, uint32_t>;
+    struct Node {
+        uint32_t parent = 0;
+        std::vector<Child> children;   // sorted by name
+    };
+    std::vector<Node> nodes;
+    uint32_t root_;
+    size_t _size = 1;
+
+    static std::vector<Child>::const_iterator lower(const std::vector<Child>& ch, const std::string& name) {
+        return std::lower_bound(ch.begin(), ch.end(), name,
+                                [](const Child& c, const std::string& n) { return c.first < n; });
+    }
+    static std::vector<Child>::iterator lower(std::vector<Child>& ch, const std::string& name) {
+        return std::lower_bound(ch.begin(), ch.end(), name,
+                                [](const Child& c, const std::string& n) { return c.first < n; });
+    }
+    void grow(uint32_t node) {
+        if (node >= nodes.size()) nodes.resize(size_t(node) + 1);
+    }
+    template <typename Fn>
+    bool walk_from(uint32_t dir, std::string& path, Fn& fn) const {
+        if (dir >= nodes.size()) return true;
+        size_t base = path.size();
+        for (const Child& c : nodes[dir].children) {
+            if (base) path += '/';
+            path += c.first;
+            bool go = fn(static_cast<const std::string&>(path), c.second) && walk_from(c.second, path, fn);
+            path.resize(base);
+            if (!go) return false;
+        }
+        return true;
+    }
+    template <typename Fn>
+    bool walk_after_from(uint32_t dir, std::string& path, const std::vector<std::string>& after, size_t depth, Fn& fn) const {
+        if (depth >= after.size()) return walk_from(dir, path, fn);
+        if (dir >= nodes.size()) return true;
+        const auto& ch = nodes[dir].children;
+        size_t base = path.size();
+        for (auto it = lower(ch, after[depth]); it != ch.end(); ++it) {
+            if (base) path += '/';
+            path += it->first;
+            bool go;
+            if (it->first == after[depth])
+                go = walk_after_from(it->second, path, after, depth + 1, fn);   // visited already; resume below it
+            else
+                go = fn(static_cast<const std::string&>(path), it->second) && walk_from(it->second, path, fn);
+            path.resize(base);
+            if (!go) return false;
+        }
+        return true;
+    }
+};
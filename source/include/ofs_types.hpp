@@ -23,7 +23,8 @@ enum class OFSErrorCodes : int32_t {
     ERROR_NOT_IMPLEMENTED = -8,
     ERROR_INVALID_SESSION = -9,
     ERROR_DIRECTORY_NOT_EMPTY = -10,
-    ERROR_INVALID_OPERATION = -11
+    ERROR_INVALID_OPERATION = -11,
+    ERROR_FILE_CHANGED = -12
 };
 enum class EntryType : uint8_t {
     FILE = 0,
@@ -99,9 +100,10 @@ struct FileEntry {
     uint64_t modified_time;    
     char owner[32];           
     uint32_t inode;          
-    uint8_t reserved[95];      
+    uint64_t version;         // bumped on every change to a file's contents
+    uint8_t reserved[87];      
 
-    FileEntry() : type(0), size(0), permissions(0), created_time(0), modified_time(0), inode(0) {
+    FileEntry() : type(0), size(0), permissions(0), created_time(0), modified_time(0), inode(0), version(0) {
         std::memset(name, 0, sizeof(name));
         std::memset(owner, 0, sizeof(owner));
         std::memset(reserved, 0, sizeof(reserved));
@@ -110,7 +112,7 @@ struct FileEntry {
     FileEntry(const std::string& filename, EntryType entry_type, uint64_t file_size,
               uint32_t perms, const std::string& file_owner, uint32_t file_inode)
         : type(static_cast<uint8_t>(entry_type)), size(file_size), permissions(perms),
-          created_time(0), modified_time(0), inode(file_inode) {
+          created_time(0), modified_time(0), inode(file_inode), version(0) {
         std::memset(name, 0, sizeof(name));
         std::memset(owner, 0, sizeof(owner));
         std::strncpy(name, filename.c_str(), sizeof(name) - 1);
@@ -181,6 +183,68 @@ struct FSStats {
         std::memset(reserved, 0, sizeof(reserved));
     }
 };
+// A byte range of the .omni container holding part of a file's payload. An offset of 0
+// marks a hole: `length` zero bytes with no storage. Ranges are only valid for the handle
+// that mapped them (see handle_map_extents).
+struct OFSExtent {
+    uint64_t offset;
+    uint64_t length;
+};
+enum class OFSBatchOpType : uint32_t {
+    CREATE_FILE = 0,
+    DELETE_FILE = 1,
+    RENAME = 2,
+    CREATE_DIR = 3,
+    DELETE_DIR = 4,
+    SET_PERMISSIONS = 5
+};
+// One operation of an fs_batch call; `result` receives its return code.
+struct OFSBatchOp {
+    OFSBatchOpType type;
+    const char* path;
+    const char* arg;         // CREATE_FILE: contents (`size` bytes); RENAME: new path
+    size_t size;
+    uint32_t permissions;    // SET_PERMISSIONS
+    int result;
+};
+// Compact listing entry returned by dir_list_names.
+#pragma pack(push, 1)
+struct OFSNameEntry {
+    char name[12];
+    uint8_t type;
+};
+#pragma pack(pop)
+enum class OFSWatchEventType : uint32_t {
+    CREATE = 0,
+    DELETE = 1,
+    RENAME = 2,
+    MODIFY = 3
+};
+// Passed to a watch callback; the strings are only valid during the call.
+struct OFSWatchEvent {
+    OFSWatchEventType type;
+    uint8_t entry_type;      // EntryType of the changed entry
+    uint32_t inode;
+    const char* path;
+    const char* old_path;    // RENAME: the path before the move; otherwise null
+};
+typedef void (*OFSWatchCallback)(const OFSWatchEvent* event, void* ctx);
+// Identifies one state of a file's contents. The version is kept per metadata slot and
+// only ever grows, also when the slot is reused, so no two contents share a tag.
+struct OFSVersionTag {
+    uint32_t inode;
+    uint64_t version;
+};
+// Criteria for fs_find; zero or null fields match everything.
+struct OFSFindFilter {
+    const char* name;          // fnmatch glob on the entry name, or on its path below the root if it contains '/'
+    int type;                  // 0 = any, 1 = files only, 2 = directories only
+    uint64_t min_size;
+    uint64_t max_size;
+    const char* owner;         // username
+    uint64_t modified_after;   // unix seconds, inclusive
+    uint64_t modified_before;
+};
 static_assert(sizeof(OMNIHeader) == 512, "OMNIHeader must be exactly 512 bytes");
 static_assert(sizeof(UserInfo) == 128, "UserInfo must be exactly 128 bytes");
 static_assert(sizeof(FileEntry) == 416, "FileEntry must be exactly 416 bytes");
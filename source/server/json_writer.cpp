@@ -0,0 +1,91 @@
+#include "json_writer.hpp"
+#include <cstring>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Buffers that grew past this are released instead of being kept for reuse.
+static const size_t THREAD_BUFFER_KEEP = 4u << 20;
+static const int THREAD_BUFFER_SLOTS = 2;
+
+static const char HEX[] = "0123456789abcdef";
+
+static inline bool needs_escape(unsigned char c) {
+    return c < 0x20 || c == '"' || c == '\\';
+}
+
+static inline void escape_one(std::string& out, unsigned char c) {
+    switch (c) {
+        case '"': out.append("\\\"", 2); break;
+        case '\\': out.append("\\\\", 2); break;
+        case '\n': out.append("\\n", 2); break;
+        case '\r': out.append("\\r", 2); break;
+        case '\t': out.append("\\t", 2); break;
+        case '\b': out.append("\\b", 2); break;
+        case '\f': out.append("\\f", 2); break;
+        default: {
+            char u[6] = {'\\', 'u', '0', '0', HEX[c >> 4], HEX[c & 0xF]};
+            out.append(u, 6);
+        }
+    }
+}
+
+void json_escape_append(std::string& out, const char* s, size_t len) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(s);
+    size_t i = 0;
+    size_t run = 0;   // start of the current clean run
+    out.reserve(out.size() + len + 2);
+#if defined(__SSE2__)
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i bslash = _mm_set1_epi8('\\');
+    const __m128i ctrl_max = _mm_set1_epi8(0x1F);
+    while (i + 16 <= len) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        // unsigned v <= 0x1F  <=>  max(v, 0x1F) == 0x1F
+        __m128i ctrl = _mm_cmpeq_epi8(_mm_max_epu8(v, ctrl_max), ctrl_max);
+        __m128i hit = _mm_or_si128(ctrl, _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, bslash)));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(hit));
+        if (mask == 0) { i += 16; continue; }
+        while (mask) {
+            size_t pos = i + static_cast<size_t>(__builtin_ctz(mask));
+            out.append(s + run, pos - run);
+            escape_one(out, p[pos]);
+            run = pos + 1;
+            mask &= mask - 1;
+        }
+        i += 16;
+    }
+#endif
+    for (; i < len; ++i) {
+        if (!needs_escape(p[i])) continue;
+        out.append(s + run, i - run);
+        escape_one(out, p[i]);
+        run = i + 1;
+    }
+    out.append(s + run, len - run);
+}
+
+JsonWriter& JsonWriter::value(uint64_t v) {
+    sep();
+    char tmp[24];
+    int n = 0;
+    do { tmp[n++] = static_cast<char>('0' + v % 10); v /= 10; } while (v);
+    while (n) buf.push_back(tmp[--n]);
+    return *this;
+}
+
+JsonWriter& JsonWriter::value(int64_t v) {
+    if (v >= 0) return value(static_cast<uint64_t>(v));
+    sep();
+    buf.push_back('-');
+    after_key = true;   // the digits below belong to this value
+    return value(static_cast<uint64_t>(0) - static_cast<uint64_t>(v));
+}
+
+std::string& json_thread_buffer(int slot) {
+    thread_local std::string buffers[THREAD_BUFFER_SLOTS];
+    std::string& b = buffers[slot];
+    if (b.capacity() > THREAD_BUFFER_KEEP) std::string().swap(b);
+    b.clear();
+    return b;
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <cstddef>
+
+// Appends the JSON-escaped form of s (without surrounding quotes) to out.
+// Clean runs are copied in bulk; only '"', '\\' and control bytes are rewritten.
+void json_escape_append(std::string& out, const char* s, size_t len);
+
+// Minimal streaming JSON writer appending straight into a caller-owned buffer.
+// Commas between members/elements are inserted automatically.
+class JsonWriter {
+public:
+    explicit JsonWriter(std::string& out) : buf(out), depth(0) { first[0] = true; }
+
+    JsonWriter& begin_object() { sep(); buf.push_back('{'); push(); return *this; }
+    JsonWriter& end_object() { pop(); buf.push_back('}'); return *this; }
+    JsonWriter& begin_array() { sep(); buf.push_back('['); push(); return *this; }
+    JsonWriter& end_array() { pop(); buf.push_back(']'); return *this; }
+
+    JsonWriter& key(std::string_view k) {
+        sep();
+        string_raw(k.data(), k.size());
+        buf.push_back(':');
+        after_key = true;
+        return *this;
+    }
+
+    JsonWriter& value(std::string_view s) { sep(); string_raw(s.data(), s.size()); return *this; }
+    JsonWriter& value(const char* s, size_t len) { sep(); string_raw(s, len); return *this; }
+    JsonWriter& value(const char* s) { return value(std::string_view(s)); }
+    JsonWriter& value(const std::string& s) { return value(std::string_view(s)); }
+    JsonWriter& value(bool b) { sep(); buf.append(b ? "true" : "false"); return *this; }
+    JsonWriter& value(uint64_t v);
+    JsonWriter& value(int64_t v);
+    JsonWriter& value(uint32_t v) { return value(static_cast<uint64_t>(v)); }
+    JsonWriter& value(int v) { return value(static_cast<int64_t>(v)); }
+    // Appends an already-serialized JSON value.
+    JsonWriter& raw(std::string_view json) { sep(); buf.append(json.data(), json.size()); return *this; }
+
+    template<typename T>
+    JsonWriter& field(std::string_view k, const T& v) { key(k); return value(v); }
+
+private:
+    static const int MAX_DEPTH = 32;
+    std::string& buf;
+    int depth;
+    bool first[MAX_DEPTH];
+    bool after_key = false;
+
+    void sep() {
+        if (after_key) { after_key = false; return; }
+        if (!first[depth]) buf.push_back(',');
+        first[depth] = false;
+    }
+    void push() { if (depth + 1 < MAX_DEPTH) first[++depth] = true; }
+    void pop() { if (depth > 0) --depth; }
+    void string_raw(const char* s, size_t len) {
+        buf.push_back('"');
+        json_escape_append(buf, s, len);
+        buf.push_back('"');
+    }
+};
+
+// Per-thread scratch buffer, cleared but keeping its capacity between uses.
+std::string& json_thread_buffer(int slot);
@@ -0,0 +1,185 @@
+#include "logger.hpp"
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdarg>
+#include <cstring>
+#include <ctime>
+
+static const size_t LOG_RING_SIZE = 1024;   // records per thread; a power of two
+static const size_t MAX_LOG_THREADS = 256;
+static const int FLUSH_INTERVAL_MS = 50;
+
+struct LogRecord {
+    uint64_t wall_ns;
+    int64_t latency_ns;
+    int fd;
+    LogLevel level;
+    OFSOpcode op;
+    char user[32];
+    char msg[192];
+};
+
+// Single-producer/single-consumer ring: the owning thread advances head, the flusher tail.
+struct alignas(64) LogRing {
+    std::atomic<uint64_t> head{0};
+    alignas(64) std::atomic<uint64_t> tail{0};
+    std::atomic<uint64_t> dropped{0};
+    uint64_t dropped_reported = 0;    // flusher only
+    LogRecord records[LOG_RING_SIZE];
+};
+
+std::atomic<uint8_t> g_log_level{static_cast<uint8_t>(LogLevel::INFO)};
+
+static std::mutex g_rings_mtx;
+static std::vector<LogRing*> g_rings;
+static std::atomic<uint64_t> g_unringed_drops{0};   // threads past MAX_LOG_THREADS
+
+static std::mutex g_flush_mtx;
+static std::condition_variable g_flush_cv;
+static bool g_flush_stop = false;
+static std::thread g_flusher;
+
+static LogRing* local_ring() {
+    thread_local LogRing* mine = nullptr;
+    thread_local bool registered = false;
+    if (registered) return mine;
+    std::lock_guard<std::mutex> lock(g_rings_mtx);
+    // A ring has exactly one producer, so threads past the cap cannot share one.
+    if (g_rings.size() < MAX_LOG_THREADS) { mine = new LogRing(); g_rings.push_back(mine); }
+    registered = true;
+    return mine;
+}
+
+static uint64_t wall_now_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+bool log_parse_level(const std::string& s, LogLevel& level) {
+    static const struct { const char* name; LogLevel level; } LEVELS[] = {
+        {"debug", LogLevel::DEBUG}, {"info", LogLevel::INFO}, {"warn", LogLevel::WARN},
+        {"error", LogLevel::ERROR}, {"off", LogLevel::OFF},
+    };
+    for (const auto& l : LEVELS)
+        if (s == l.name) { level = l.level; return true; }
+    return false;
+}
+
+void log_event(LogLevel level, const LogFields& fields, const char* fmt, ...) {
+    if (!log_enabled(level)) return;
+    LogRing* ring = local_ring();
+    if (!ring) { g_unringed_drops.fetch_add(1, std::memory_order_relaxed); return; }
+    uint64_t h = ring->head.load(std::memory_order_relaxed);
+    if (h - ring->tail.load(std::memory_order_acquire) >= LOG_RING_SIZE) {
+        ring->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    LogRecord& rec = ring->records[h & (LOG_RING_SIZE - 1)];
+    rec.wall_ns = wall_now_ns();
+    rec.latency_ns = fields.latency_ns;
+    rec.fd = fields.fd;
+    rec.level = level;
+    rec.op = fields.op;
+    rec.user[0] = '\0';
+    if (fields.user) snprintf(rec.user, sizeof(rec.user), "%s", fields.user);
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(rec.msg, sizeof(rec.msg), fmt, ap);
+    va_end(ap);
+    ring->head.store(h + 1, std::memory_order_release);
+}
+
+static const char* level_name(LogLevel level) {
+    static const char* NAMES[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+    return NAMES[static_cast<uint8_t>(level) < 4 ? static_cast<uint8_t>(level) : 3];
+}
+
+static void format_record(std::string& out, const LogRecord& r) {
+    char line[384];
+    time_t secs = static_cast<time_t>(r.wall_ns / 1000000000ull);
+    tm utc;
+    gmtime_r(&secs, &utc);
+    int n = snprintf(line, sizeof(line), "%04d-%02d-%02dT%02d:%02d:%02d.%06uZ %-5s %s",
+                     utc.tm_year + 1900, utc.tm_mon + 1, utc.tm_mday, utc.tm_hour, utc.tm_min, utc.tm_sec,
+                     static_cast<unsigned>((r.wall_ns % 1000000000ull) / 1000), level_name(r.level), r.msg);
+    out.append(line, std::min(static_cast<size_t>(n > 0 ? n : 0), sizeof(line) - 1));
+    if (r.fd >= 0) { snprintf(line, sizeof(line), " fd=%d", r.fd); out.append(line); }
+    if (r.user[0]) { out.append(" user="); out.append(r.user); }
+    if (r.op != OFSOpcode::UNKNOWN) { out.append(" op="); out.append(opcode_name(r.op)); }
+    if (r.latency_ns >= 0) { snprintf(line, sizeof(line), " latency_us=%.1f", r.latency_ns / 1e3); out.append(line); }
+    out.push_back('\n');
+}
+
+// Moves every queued record to stderr in timestamp order.
+static void flush_rings(std::vector<LogRecord>& batch, std::string& out) {
+    std::vector<LogRing*> rings;
+    {
+        std::lock_guard<std::mutex> lock(g_rings_mtx);
+        rings = g_rings;
+    }
+    batch.clear();
+    uint64_t dropped = 0;
+    for (LogRing* ring : rings) {
+        uint64_t t = ring->tail.load(std::memory_order_relaxed);
+        uint64_t h = ring->head.load(std::memory_order_acquire);
+        for (; t != h; ++t) batch.push_back(ring->records[t & (LOG_RING_SIZE - 1)]);
+        ring->tail.store(t, std::memory_order_release);
+        uint64_t d = ring->dropped.load(std::memory_order_relaxed);
+        dropped += d - ring->dropped_reported;
+        ring->dropped_reported = d;
+    }
+    dropped += g_unringed_drops.exchange(0, std::memory_order_relaxed);
+    if (batch.empty() && !dropped) return;
+    std::stable_sort(batch.begin(), batch.end(),
+                     [](const LogRecord& a, const LogRecord& b) { return a.wall_ns < b.wall_ns; });
+    out.clear();
+    for (const LogRecord& r : batch) format_record(out, r);
+    if (dropped) {
+        LogRecord r{};
+        r.wall_ns = wall_now_ns();
+        r.latency_ns = -1;
+        r.fd = -1;
+        r.level = LogLevel::WARN;
+        snprintf(r.msg, sizeof(r.msg), "logger dropped %llu records (ring full)", (unsigned long long)dropped);
+        format_record(out, r);
+    }
+    fwrite(out.data(), 1, out.size(), stderr);
+    fflush(stderr);
+}
+
+static void flusher_loop() {
+    std::vector<LogRecord> batch;
+    std::string out;
+    std::unique_lock<std::mutex> lock(g_flush_mtx);
+    while (!g_flush_stop) {
+        g_flush_cv.wait_for(lock, std::chrono::milliseconds(FLUSH_INTERVAL_MS));
+        lock.unlock();
+        flush_rings(batch, out);
+        lock.lock();
+    }
+    lock.unlock();
+    flush_rings(batch, out);
+}
+
+void log_start(LogLevel level) {
+    g_log_level.store(static_cast<uint8_t>(level), std::memory_order_relaxed);
+    if (g_flusher.joinable()) return;
+    g_flush_stop = false;
+    g_flusher = std::thread(flusher_loop);
+}
+
+void log_stop() {
+    if (!g_flusher.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lock(g_flush_mtx);
+        g_flush_stop = true;
+    }
+    g_flush_cv.notify_one();
+    g_flusher.join();
+}
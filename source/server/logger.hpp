@@ -0,0 +1,33 @@
+#pragma once
+#include <atomic>
+#include <string>
+#include <cstdint>
+#include "opcodes.hpp"
+
+enum class LogLevel : uint8_t { DEBUG = 0, INFO, WARN, ERROR, OFF };
+
+// Structured fields attached to a record; unset fields are left out of the output line.
+struct LogFields {
+    int fd = -1;
+    const char* user = nullptr;
+    OFSOpcode op = OFSOpcode::UNKNOWN;
+    int64_t latency_ns = -1;
+};
+
+extern std::atomic<uint8_t> g_log_level;
+
+inline bool log_enabled(LogLevel level) {
+    return static_cast<uint8_t>(level) >= g_log_level.load(std::memory_order_relaxed);
+}
+
+// "debug", "info", "warn", "error" or "off"; returns false for anything else.
+bool log_parse_level(const std::string& s, LogLevel& level);
+
+// Starts the flusher thread that writes records to stderr. Until then records stay queued.
+void log_start(LogLevel level);
+// Writes everything still queued and joins the flusher.
+void log_stop();
+
+// Formats the message into the calling thread's ring and returns without I/O or locks.
+// A record is dropped (and counted) when the ring is full.
+void log_event(LogLevel level, const LogFields& fields, const char* fmt, ...) __attribute__((format(printf, 3, 4)));
@@ -1,26 +1,43 @@
 
 #include "server.hpp"
+#include "logger.hpp"
 #include "../core/ofs_core.hpp"
 #include <iostream>
 #include <fstream>
 #include <string>
 
+// Value after '=' with any trailing "# comment", surrounding blanks and quotes removed.
+static std::string config_string(const std::string& line) {
+    size_t eq = line.find('=');
+    if (eq == std::string::npos) return "";
+    std::string v = line.substr(eq + 1, line.find('#', eq) - eq - 1);
+    size_t b = v.find_first_not_of(" \t\"");
+    size_t e = v.find_last_not_of(" \t\"\r");
+    return (b == std::string::npos) ? "" : v.substr(b, e - b + 1);
+}
+
 int main() {
     void* fs_instance = nullptr;
     std::ifstream file("compiled/default.uconf");
     uint16_t port = 8080;
     uint32_t max_connections = 20;
     uint32_t queue_timeout = 30;
+    std::string unix_socket;
+    uint32_t reactor_threads = 1;
+
+    SchedulerConfig sched;
+    LogLevel log_level = LogLevel::INFO;
 
     if (file.is_open()) {
         std::string line;
-        bool in_server = false;
+        std::string section;
         while (std::getline(file, line)) {
-            if (line.find("[server]") != std::string::npos) {
-                in_server = true;
+            size_t open = line.find_first_not_of(" \t");
+            if (open != std::string::npos && line[open] == '[') {
+                section = line.substr(open, line.find(']') - open + 1);
                 continue;
             }
-            if (in_server) {
+            if (section == "[server]") {
                 if (line.find("port") != std::string::npos) {
                     size_t eq = line.find('=');
                     if (eq != std::string::npos)
@@ -36,23 +53,49 @@ int main() {
                     if (eq != std::string::npos)
                         queue_timeout = static_cast<uint32_t>(std::stoi(line.substr(eq + 1)));
                 }
-                if (line.find("[") != std::string::npos && line.find("[server]") == std::string::npos)
-                    break;
+                if (line.find("reactor_threads") != std::string::npos) {
+                    size_t eq = line.find('=');
+                    if (eq != std::string::npos)
+                        reactor_threads = static_cast<uint32_t>(std::stoi(line.substr(eq + 1)));
+                }
+                if (line.find("unix_socket") != std::string::npos)
+                    unix_socket = config_string(line);
+            }
+            if (section == "[scheduler]") {
+                size_t eq = line.find('=');
+                std::string v = config_string(line);
+                if (eq != std::string::npos && !v.empty()) {
+                    uint32_t n = static_cast<uint32_t>(std::stoul(v));
+                    if (line.find("admin_weight") != std::string::npos) sched.admin_weight = n;
+                    else if (line.find("user_weight") != std::string::npos) sched.user_weight = n;
+                    else if (line.find("rate_limit") != std::string::npos) sched.rate_limit = n;
+                    else if (line.find("rate_burst") != std::string::npos) sched.rate_burst = n;
+                    else if (line.find("metadata_workers") != std::string::npos) sched.metadata_workers = n;
+                    else if (line.find("bulk_workers") != std::string::npos) sched.bulk_workers = n;
+                }
+            }
+            if (section == "[logging]" && line.find("level") != std::string::npos) {
+                std::string v = config_string(line);
+                if (!log_parse_level(v, log_level))
+                    std::cerr << "[OFS] Unknown log level '" << v << "', using info\n";
             }
         }
     }
 
-    std::cout << "[OFS] Loaded config: port=" << port 
-              << ", max_connections=" << max_connections 
-              << ", queue_timeout=" << queue_timeout << "\n";
+    log_start(log_level);
+    log_event(LogLevel::INFO, LogFields{}, "loaded config: port=%u max_connections=%u queue_timeout=%u",
+              (unsigned)port, (unsigned)max_connections, (unsigned)queue_timeout);
     int r = fs_init(&fs_instance, "compiled/sample.omni", "compiled/default.uconf");
     if (r != 0) {
-        std::cerr << "Failed to init filesystem: " << get_error_message(r) << "\n";
+        log_event(LogLevel::ERROR, LogFields{}, "failed to init filesystem: %s", get_error_message(r));
+        log_stop();
         return 1;
     }
+    log_event(LogLevel::INFO, LogFields{}, "block I/O engine: %s", fs_io_engine(fs_instance));
     OFSServer server;
-    if (!server.start(port, fs_instance, max_connections, queue_timeout)) {
-        std::cerr << "Failed to start server\n";
+    if (!server.start(port, fs_instance, max_connections, queue_timeout, unix_socket, reactor_threads, sched)) {
+        log_event(LogLevel::ERROR, LogFields{}, "failed to start server");
+        log_stop();
         return 1;
     }
 
@@ -61,6 +104,7 @@ int main() {
 
     server.stop();
     fs_shutdown(fs_instance);
+    log_stop();
     return 0;
 }
 
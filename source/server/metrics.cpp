@@ -0,0 +1,154 @@
+#include "metrics.hpp"
+#include <mutex>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+#include <cstdarg>
+
+// Threads beyond this share the last slot; updates stay correct because they are atomic adds.
+static const size_t MAX_METRIC_THREADS = 256;
+static const size_t OP_COUNT = static_cast<size_t>(OFSOpcode::COUNT);
+
+static std::mutex g_registry_mtx;
+static std::vector<ThreadMetrics*> g_registry;
+static std::atomic<int64_t> g_queue_depth{0};
+
+uint64_t metrics_now_ns() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+ThreadMetrics& metrics_local() {
+    thread_local ThreadMetrics* mine = nullptr;
+    if (mine) return *mine;
+    std::lock_guard<std::mutex> lock(g_registry_mtx);
+    if (g_registry.size() < MAX_METRIC_THREADS) g_registry.push_back(new ThreadMetrics());
+    // Slots are never freed: a scrape may still be reading one after its thread exits.
+    mine = g_registry.back();
+    return *mine;
+}
+
+static inline int hist_bucket(uint64_t v) {
+    if (v < (1u << HIST_SUB_BITS)) return static_cast<int>(v);
+    int e = 63 - __builtin_clzll(v);
+    if (e > HIST_MAX_EXP) return HIST_BUCKETS - 1;
+    int sub = static_cast<int>((v >> (e - HIST_SUB_BITS)) & ((1u << HIST_SUB_BITS) - 1));
+    return ((e - HIST_SUB_BITS + 1) << HIST_SUB_BITS) + sub;
+}
+
+// Highest value that falls into bucket i.
+static inline uint64_t hist_bucket_high(int i) {
+    if (i < (1 << HIST_SUB_BITS)) return static_cast<uint64_t>(i);
+    int shift = (i >> HIST_SUB_BITS) - 1;
+    uint64_t low = static_cast<uint64_t>((1 << HIST_SUB_BITS) + (i & ((1 << HIST_SUB_BITS) - 1))) << shift;
+    return low + (uint64_t(1) << shift) - 1;
+}
+
+void metrics_record(LatencyHistogram& h, uint64_t ns) {
+    metrics_add(h.count, 1);
+    metrics_add(h.sum_ns, ns);
+    metrics_add(h.buckets[hist_bucket(ns)], 1);
+}
+
+void metrics_queue_depth_add(int64_t delta) {
+    g_queue_depth.fetch_add(delta, std::memory_order_relaxed);
+}
+
+// Plain sum of one histogram over all threads.
+struct HistSnapshot {
+    uint64_t count = 0;
+    uint64_t sum_ns = 0;
+    uint64_t buckets[HIST_BUCKETS] = {};
+
+    void add(const LatencyHistogram& h) {
+        count += h.count.load(std::memory_order_relaxed);
+        sum_ns += h.sum_ns.load(std::memory_order_relaxed);
+        for (int i = 0; i < HIST_BUCKETS; ++i) buckets[i] += h.buckets[i].load(std::memory_order_relaxed);
+    }
+    uint64_t quantile_ns(double q) const {
+        uint64_t total = 0;
+        for (int i = 0; i < HIST_BUCKETS; ++i) total += buckets[i];
+        if (total == 0) return 0;
+        uint64_t rank = static_cast<uint64_t>(q * static_cast<double>(total - 1)) + 1;
+        uint64_t seen = 0;
+        for (int i = 0; i < HIST_BUCKETS; ++i) {
+            seen += buckets[i];
+            if (seen >= rank) return hist_bucket_high(i);
+        }
+        return hist_bucket_high(HIST_BUCKETS - 1);
+    }
+};
+
+static const char* op_name(size_t op) { return opcode_name(static_cast<OFSOpcode>(op)); }
+
+static void append_line(std::string& out, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+static void append_line(std::string& out, const char* fmt, ...) {
+    char line[256];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    if (n > 0) out.append(line, static_cast<size_t>(n) < sizeof(line) ? static_cast<size_t>(n) : sizeof(line) - 1);
+}
+
+static void render_summary(std::string& out, const char* name, const char* labels, const HistSnapshot& h) {
+    static const double QUANTILES[] = {0.5, 0.9, 0.99, 0.999};
+    const char* sep = labels[0] ? "," : "";
+    char braced[80] = "";
+    if (labels[0]) snprintf(braced, sizeof(braced), "{%s}", labels);
+    for (double q : QUANTILES)
+        append_line(out, "%s{%s%squantile=\"%g\"} %.9f\n", name, labels, sep, q, h.quantile_ns(q) / 1e9);
+    append_line(out, "%s_sum%s %.9f\n", name, braced, h.sum_ns / 1e9);
+    append_line(out, "%s_count%s %llu\n", name, braced, (unsigned long long)h.count);
+}
+
+void metrics_render(std::string& out) {
+    std::vector<ThreadMetrics*> slots;
+    {
+        std::lock_guard<std::mutex> lock(g_registry_mtx);
+        slots = g_registry;
+    }
+    std::vector<HistSnapshot> ops(OP_COUNT);
+    std::vector<uint64_t> errors(OP_COUNT, 0);
+    HistSnapshot queue_wait;
+    uint64_t bytes_in = 0, bytes_out = 0, accepted = 0, cache_hits = 0, cache_misses = 0;
+    for (const ThreadMetrics* t : slots) {
+        for (size_t op = 0; op < OP_COUNT; ++op) {
+            ops[op].add(t->ops[op].latency);
+            errors[op] += t->ops[op].errors.load(std::memory_order_relaxed);
+        }
+        queue_wait.add(t->queue_wait);
+        bytes_in += t->bytes_in.load(std::memory_order_relaxed);
+        bytes_out += t->bytes_out.load(std::memory_order_relaxed);
+        accepted += t->connections_accepted.load(std::memory_order_relaxed);
+        cache_hits += t->cache_hits.load(std::memory_order_relaxed);
+        cache_misses += t->cache_misses.load(std::memory_order_relaxed);
+    }
+
+    out.append("# HELP ofs_requests_total Requests handled, by operation.\n# TYPE ofs_requests_total counter\n");
+    for (size_t op = 0; op < OP_COUNT; ++op)
+        if (ops[op].count) append_line(out, "ofs_requests_total{op=\"%s\"} %llu\n", op_name(op), (unsigned long long)ops[op].count);
+    out.append("# HELP ofs_request_errors_total Requests that returned an error, by operation.\n# TYPE ofs_request_errors_total counter\n");
+    for (size_t op = 0; op < OP_COUNT; ++op)
+        if (ops[op].count) append_line(out, "ofs_request_errors_total{op=\"%s\"} %llu\n", op_name(op), (unsigned long long)errors[op]);
+    out.append("# HELP ofs_request_duration_seconds Time from dequeue to reply queued, by operation.\n# TYPE ofs_request_duration_seconds summary\n");
+    for (size_t op = 0; op < OP_COUNT; ++op) {
+        if (!ops[op].count) continue;
+        char labels[64];
+        snprintf(labels, sizeof(labels), "op=\"%s\"", op_name(op));
+        render_summary(out, "ofs_request_duration_seconds", labels, ops[op]);
+    }
+    out.append("# HELP ofs_queue_wait_seconds Time requests spent in the worker queue.\n# TYPE ofs_queue_wait_seconds summary\n");
+    render_summary(out, "ofs_queue_wait_seconds", "", queue_wait);
+    out.append("# HELP ofs_queue_depth Requests waiting for a worker.\n# TYPE ofs_queue_depth gauge\n");
+    append_line(out, "ofs_queue_depth %lld\n", (long long)g_queue_depth.load(std::memory_order_relaxed));
+    out.append("# HELP ofs_bytes_received_total Bytes read from client sockets.\n# TYPE ofs_bytes_received_total counter\n");
+    append_line(out, "ofs_bytes_received_total %llu\n", (unsigned long long)bytes_in);
+    out.append("# HELP ofs_bytes_sent_total Bytes written to client sockets.\n# TYPE ofs_bytes_sent_total counter\n");
+    append_line(out, "ofs_bytes_sent_total %llu\n", (unsigned long long)bytes_out);
+    out.append("# HELP ofs_connections_accepted_total Client connections accepted.\n# TYPE ofs_connections_accepted_total counter\n");
+    append_line(out, "ofs_connections_accepted_total %llu\n", (unsigned long long)accepted);
+    out.append("# HELP ofs_response_cache_lookups_total dir_list/get_metadata replies looked up in the response cache.\n# TYPE ofs_response_cache_lookups_total counter\n");
+    append_line(out, "ofs_response_cache_lookups_total{result=\"hit\"} %llu\n", (unsigned long long)cache_hits);
+    append_line(out, "ofs_response_cache_lookups_total{result=\"miss\"} %llu\n", (unsigned long long)cache_misses);
+}
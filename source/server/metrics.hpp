@@ -0,0 +1,49 @@
+#pragma once
+#include <atomic>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include "opcodes.hpp"
+
+// Log-linear latency histogram in the style of HDR histograms: values below 8 get
+// exact buckets, larger values 8 sub-buckets per power of two (<= 12.5% error).
+// Values are nanoseconds and saturate at 2^40 (~18 minutes).
+static const int HIST_SUB_BITS = 3;
+static const int HIST_MAX_EXP = 40;
+static const int HIST_BUCKETS = (HIST_MAX_EXP - HIST_SUB_BITS + 2) << HIST_SUB_BITS;
+
+struct LatencyHistogram {
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> sum_ns{0};
+    std::atomic<uint64_t> buckets[HIST_BUCKETS] = {};
+};
+
+struct OpMetrics {
+    std::atomic<uint64_t> errors{0};
+    LatencyHistogram latency;
+};
+
+// Counters owned by one thread. Each thread writes only its own slot, so updates never
+// contend; slots are aligned to cache lines so neighbouring threads do not false-share.
+struct alignas(64) ThreadMetrics {
+    OpMetrics ops[static_cast<size_t>(OFSOpcode::COUNT)];
+    LatencyHistogram queue_wait;
+    alignas(64) std::atomic<uint64_t> bytes_in{0};
+    std::atomic<uint64_t> bytes_out{0};
+    std::atomic<uint64_t> connections_accepted{0};
+    std::atomic<uint64_t> cache_hits{0};
+    std::atomic<uint64_t> cache_misses{0};
+};
+
+uint64_t metrics_now_ns();
+// The calling thread's counters, registered on first use.
+ThreadMetrics& metrics_local();
+
+void metrics_record(LatencyHistogram& h, uint64_t ns);
+inline void metrics_add(std::atomic<uint64_t>& c, uint64_t n) { c.fetch_add(n, std::memory_order_relaxed); }
+
+// Requests waiting in the worker queue (not per-thread: it is a gauge).
+void metrics_queue_depth_add(int64_t delta);
+
+// Sums every thread's counters into Prometheus text exposition format.
+void metrics_render(std::string& out);
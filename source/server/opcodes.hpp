@@ -0,0 +1,150 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+enum class OFSOpcode : uint8_t {
+    UNKNOWN = 0,
+    LOGIN,
+    LOGOUT,
+    CREATE_USER,
+    DELETE_USER,
+    LIST_USERS,
+    CREATE_DIR,
+    DELETE_DIR,
+    DIR_EXISTS,
+    DIR_LIST,
+    CREATE_FILE,
+    READ_FILE,
+    EDIT_FILE,
+    TRUNCATE_FILE,
+    RENAME_FILE,
+    DELETE_FILE,
+    GET_METADATA,
+    SET_PERMISSIONS,
+    SET_OWNER,
+    GET_SESSION_INFO,
+    DOWNLOAD,
+    UPLOAD_BEGIN,
+    UPLOAD_CHUNK,
+    UPLOAD_COMMIT,
+    UPLOAD_ABORT,
+    METRICS,
+    BATCH,
+    FILE_OPEN,
+    HANDLE_READ,
+    HANDLE_WRITE,
+    HANDLE_STAT,
+    FILE_CLOSE,
+    PREFIX_LIST,
+    FIND,
+    DELETE_TREE,
+    COPY_TREE,
+    WATCH,
+    UNWATCH,
+    LEASE,
+    UNLEASE,
+    READ_IF,
+    COUNT
+};
+
+struct OpcodeName {
+    std::string_view name;
+    OFSOpcode op;
+};
+
+// Wire names of every command. Order does not matter; the hash table below is built from it.
+constexpr OpcodeName OPCODE_NAMES[] = {
+    {"login", OFSOpcode::LOGIN},
+    {"logout", OFSOpcode::LOGOUT},
+    {"create_user", OFSOpcode::CREATE_USER},
+    {"delete_user", OFSOpcode::DELETE_USER},
+    {"list_users", OFSOpcode::LIST_USERS},
+    {"create_dir", OFSOpcode::CREATE_DIR},
+    {"delete_dir", OFSOpcode::DELETE_DIR},
+    {"dir_exists", OFSOpcode::DIR_EXISTS},
+    {"dir_list", OFSOpcode::DIR_LIST},
+    {"create_file", OFSOpcode::CREATE_FILE},
+    {"read_file", OFSOpcode::READ_FILE},
+    {"edit_file", OFSOpcode::EDIT_FILE},
+    {"truncate_file", OFSOpcode::TRUNCATE_FILE},
+    {"rename_file", OFSOpcode::RENAME_FILE},
+    {"delete_file", OFSOpcode::DELETE_FILE},
+    {"get_metadata", OFSOpcode::GET_METADATA},
+    {"set_permissions", OFSOpcode::SET_PERMISSIONS},
+    {"set_owner", OFSOpcode::SET_OWNER},
+    {"get_session_info", OFSOpcode::GET_SESSION_INFO},
+    {"download", OFSOpcode::DOWNLOAD},
+    {"upload_begin", OFSOpcode::UPLOAD_BEGIN},
+    {"upload_chunk", OFSOpcode::UPLOAD_CHUNK},
+    {"upload_commit", OFSOpcode::UPLOAD_COMMIT},
+    {"upload_abort", OFSOpcode::UPLOAD_ABORT},
+    {"metrics", OFSOpcode::METRICS},
+    {"batch", OFSOpcode::BATCH},
+    {"file_open", OFSOpcode::FILE_OPEN},
+    {"handle_read", OFSOpcode::HANDLE_READ},
+    {"handle_write", OFSOpcode::HANDLE_WRITE},
+    {"handle_stat", OFSOpcode::HANDLE_STAT},
+    {"file_close", OFSOpcode::FILE_CLOSE},
+    {"prefix_list", OFSOpcode::PREFIX_LIST},
+    {"find", OFSOpcode::FIND},
+    {"delete_tree", OFSOpcode::DELETE_TREE},
+    {"copy_tree", OFSOpcode::COPY_TREE},
+    {"watch", OFSOpcode::WATCH},
+    {"unwatch", OFSOpcode::UNWATCH},
+    {"lease", OFSOpcode::LEASE},
+    {"unlease", OFSOpcode::UNLEASE},
+    {"read_if", OFSOpcode::READ_IF},
+};
+
+inline const char* opcode_name(OFSOpcode op) {
+    for (const auto& n : OPCODE_NAMES)
+        if (n.op == op) return n.name.data();
+    return "unknown";
+}
+
+constexpr size_t OPCODE_TABLE_SIZE = 256;
+
+constexpr uint32_t opcode_hash(std::string_view s, uint32_t seed) {
+    uint32_t h = 2166136261u ^ seed;
+    for (char c : s) {
+        h ^= static_cast<uint8_t>(c);
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Smallest seed for which every command name lands in its own slot.
+constexpr uint32_t opcode_find_seed() {
+    for (uint32_t seed = 0; seed < 100000; ++seed) {
+        bool used[OPCODE_TABLE_SIZE] = {};
+        bool ok = true;
+        for (const auto& n : OPCODE_NAMES) {
+            size_t slot = opcode_hash(n.name, seed) % OPCODE_TABLE_SIZE;
+            if (used[slot]) { ok = false; break; }
+            used[slot] = true;
+        }
+        if (ok) return seed;
+    }
+    return UINT32_MAX;
+}
+
+constexpr uint32_t OPCODE_SEED = opcode_find_seed();
+static_assert(OPCODE_SEED != UINT32_MAX, "no collision-free seed for the opcode table");
+
+constexpr std::array<OpcodeName, OPCODE_TABLE_SIZE> opcode_build_table() {
+    std::array<OpcodeName, OPCODE_TABLE_SIZE> t{};
+    for (auto& slot : t) slot = OpcodeName{std::string_view(), OFSOpcode::UNKNOWN};
+    for (const auto& n : OPCODE_NAMES) t[opcode_hash(n.name, OPCODE_SEED) % OPCODE_TABLE_SIZE] = n;
+    return t;
+}
+
+constexpr auto OPCODE_TABLE = opcode_build_table();
+
+// One hash and one string compare per command.
+inline OFSOpcode lookup_opcode(std::string_view cmd) {
+    const OpcodeName& slot = OPCODE_TABLE[opcode_hash(cmd, OPCODE_SEED) % OPCODE_TABLE_SIZE];
+    return (slot.name == cmd) ? slot.op : OFSOpcode::UNKNOWN;
+}
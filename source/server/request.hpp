@@ -0,0 +1,27 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include "opcodes.hpp"
+
+struct ClientConnection;
+
+// Progress of a handler that suspended itself until the client drained its output
+// (see OFSCall::suspend). The handler finds it in OFSRequest::resume when it runs again.
+struct HandlerState {
+    virtual ~HandlerState() = default;
+};
+
+struct OFSRequest {
+    std::string cmd;
+    OFSOpcode opcode;
+    std::vector<std::string> args;
+    std::string request_id;   // client-chosen id echoed in the response ("0" if none given)
+    std::string body;         // raw bytes that followed the command line (upload_chunk)
+    uint64_t enqueued_ns = 0; // when the request entered the worker queue
+    uint64_t started_ns = 0;  // when a handler first ran it; kept across suspensions
+    std::shared_ptr<HandlerState> resume;
+    int client_fd;
+    std::shared_ptr<ClientConnection> conn;
+};
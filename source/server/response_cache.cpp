@@ -0,0 +1,30 @@
+#include "response_cache.hpp"
+
+bool ResponseCache::lookup(OFSOpcode op, uint32_t inode, uint64_t generation, const std::string& path, std::string& out) {
+    Shard& s = shards[inode % SHARDS];
+    std::lock_guard<std::mutex> lock(s.mtx);
+    auto it = s.entries.find(key(op, inode));
+    if (it == s.entries.end()) return false;
+    const Entry& e = it->second;
+    // A rename higher up changes the path without touching this inode's generation.
+    if (e.generation != generation || e.path != path) return false;
+    out.append(e.json);
+    return true;
+}
+
+void ResponseCache::store(OFSOpcode op, uint32_t inode, uint64_t generation, const std::string& path, const std::string& json) {
+    if (json.size() > MAX_VALUE_BYTES) return;
+    Shard& s = shards[inode % SHARDS];
+    std::lock_guard<std::mutex> lock(s.mtx);
+    uint64_t k = key(op, inode);
+    auto it = s.entries.find(k);
+    if (it == s.entries.end()) {
+        // Full shard: drop an arbitrary entry; the hot directories are re-added on their next poll.
+        if (s.entries.size() >= MAX_ENTRIES_PER_SHARD) s.entries.erase(s.entries.begin());
+        s.entries.emplace(k, Entry{generation, path, json});
+        return;
+    }
+    it->second.generation = generation;
+    it->second.path = path;
+    it->second.json.assign(json);
+}
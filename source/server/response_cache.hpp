@@ -0,0 +1,35 @@
+#pragma once
+#include <string>
+#include <mutex>
+#include <unordered_map>
+#include <cstdint>
+#include <cstddef>
+#include "opcodes.hpp"
+
+// Serialized "data" values of read-only replies (dir_list, get_metadata), keyed by
+// opcode and inode. An entry is served only while the inode's generation (see
+// get_generation) and the requested path still match what it was built from.
+class ResponseCache {
+public:
+    // Appends the cached value to out and returns true on a hit.
+    bool lookup(OFSOpcode op, uint32_t inode, uint64_t generation, const std::string& path, std::string& out);
+    void store(OFSOpcode op, uint32_t inode, uint64_t generation, const std::string& path, const std::string& json);
+
+private:
+    static const size_t SHARDS = 16;
+    static const size_t MAX_ENTRIES_PER_SHARD = 256;
+    static const size_t MAX_VALUE_BYTES = 256u << 10;
+
+    struct Entry {
+        uint64_t generation;
+        std::string path;
+        std::string json;
+    };
+    struct alignas(64) Shard {
+        std::mutex mtx;
+        std::unordered_map<uint64_t, Entry> entries;
+    };
+    Shard shards[SHARDS];
+
+    static uint64_t key(OFSOpcode op, uint32_t inode) { return (static_cast<uint64_t>(op) << 32) | inode; }
+};
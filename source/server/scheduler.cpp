@@ -0,0 +1,105 @@
+#include "scheduler.hpp"
+#include "metrics.hpp"
+#include <algorithm>
+#include <chrono>
+
+void RateLimiter::configure(uint32_t rate_limit, uint32_t rate_burst) {
+    std::lock_guard<std::mutex> lock(mtx);
+    rate = rate_limit;
+    burst = rate_burst ? rate_burst : 1;
+}
+
+uint64_t RateLimiter::try_take(const std::string& key, uint64_t now_ns) {
+    if (!rate) return 0;
+    std::lock_guard<std::mutex> lock(mtx);
+    Bucket& b = buckets[key];
+    // Add the tokens earned since the last refill; a new bucket starts full.
+    if (b.refill_ns == 0) {
+        b.tokens = burst;
+    } else {
+        b.tokens = std::min<double>(burst, b.tokens + (now_ns - b.refill_ns) * (rate / 1e9));
+    }
+    b.refill_ns = now_ns;
+    if (b.tokens < 1.0) return now_ns + static_cast<uint64_t>((1.0 - b.tokens) * 1e9 / rate) + 1;
+    b.tokens -= 1.0;
+    return 0;
+}
+
+void RequestScheduler::configure(const SchedulerConfig& c, RateLimiter* l) {
+    std::lock_guard<std::mutex> lock(mtx);
+    cfg = c;
+    limiter = l && l->enabled() ? l : nullptr;
+}
+
+RequestScheduler::Flow& RequestScheduler::flow_for(const std::string& key) {
+    std::unique_ptr<Flow>& f = flows[key];
+    if (!f) {
+        f.reset(new Flow());
+        f->key = key;
+    }
+    return *f;
+}
+
+void RequestScheduler::push(OFSRequest&& req, const std::string& key, uint32_t weight) {
+    std::lock_guard<std::mutex> lock(mtx);
+    Flow& f = flow_for(key);
+    f.weight = weight ? weight : 1;
+    f.queue.push_back(std::move(req));
+    if (!f.active) {
+        f.active = true;
+        active.push_back(&f);
+    }
+    cv.notify_one();
+}
+
+bool RequestScheduler::pop(OFSRequest& req) {
+    std::unique_lock<std::mutex> lock(mtx);
+    while (!stopping) {
+        uint64_t now = metrics_now_ns();
+        uint64_t wake = 0;
+        size_t skipped = 0;
+        while (!active.empty() && skipped < active.size()) {
+            Flow* f = active.front();
+            if (f->queue.empty()) {
+                active.pop_front();
+                f->active = false;
+                f->deficit = 0;
+                continue;
+            }
+            if (limiter) {
+                uint64_t due = limiter->try_take(f->key, now);
+                if (due) {
+                    // Out of tokens: let the other flows run and come back when one is earned.
+                    wake = wake ? std::min(wake, due) : due;
+                    active.pop_front();
+                    active.push_back(f);
+                    ++skipped;
+                    continue;
+                }
+            }
+            // Each request costs one unit; a flow at the head of the round gets `weight` units.
+            if (f->deficit == 0) f->deficit = f->weight;
+            req = std::move(f->queue.front());
+            f->queue.pop_front();
+            if (--f->deficit == 0 || f->queue.empty()) {
+                active.pop_front();
+                if (f->queue.empty()) {
+                    f->active = false;
+                    f->deficit = 0;
+                } else {
+                    active.push_back(f);
+                }
+            }
+            return true;
+        }
+        if (wake) cv.wait_for(lock, std::chrono::nanoseconds(wake - now));
+        else cv.wait(lock);
+    }
+    return false;
+}
+
+void RequestScheduler::shutdown() {
+    std::lock_guard<std::mutex> lock(mtx);
+    stopping = true;
+    cv.notify_all();
+}
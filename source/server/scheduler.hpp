@@ -0,0 +1,74 @@
+#pragma once
+#include <string>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <condition_variable>
+#include <cstdint>
+#include "request.hpp"
+
+struct SchedulerConfig {
+    uint32_t admin_weight = 4;     // requests an admin's flow may run per round
+    uint32_t user_weight = 1;
+    uint32_t rate_limit = 0;       // sustained requests per second per user; 0 = unlimited
+    uint32_t rate_burst = 100;     // requests a user may run back to back before the limit applies
+    uint32_t metadata_workers = 2; // worker threads per lane (see OpLane)
+    uint32_t bulk_workers = 2;
+};
+
+// One token bucket per user, shared by every lane and by inline dispatch, so a user's
+// limit covers all of their requests wherever they run.
+class RateLimiter {
+public:
+    void configure(uint32_t rate_limit, uint32_t rate_burst);
+    bool enabled() const { return rate != 0; }
+    // Takes one token from the user's bucket. Returns 0 on success, otherwise the time
+    // (metrics_now_ns) at which the next token is due.
+    uint64_t try_take(const std::string& key, uint64_t now_ns);
+
+private:
+    struct Bucket {
+        double tokens = 0;
+        uint64_t refill_ns = 0;
+    };
+
+    uint32_t rate = 0;
+    uint32_t burst = 1;
+    std::mutex mtx;
+    std::unordered_map<std::string, Bucket> buckets;
+};
+
+// Sits between request parsing and the worker pool. Requests are grouped into one flow
+// per user (connections that have not logged in share one), and workers take them in
+// deficit round robin order, so a user with many busy connections gets its weight's
+// share of the workers rather than one slot per queued request.
+class RequestScheduler {
+public:
+    // Every lane is given the server's limiter; nullptr runs without a rate limit.
+    void configure(const SchedulerConfig& cfg, RateLimiter* limiter);
+    void push(OFSRequest&& req, const std::string& flow, uint32_t weight);
+    // Blocks until a request may run; returns false once shutdown() was called.
+    bool pop(OFSRequest& req);
+    void shutdown();
+
+private:
+    struct Flow {
+        std::string key;
+        std::deque<OFSRequest> queue;
+        uint32_t weight = 1;
+        uint32_t deficit = 0;
+        bool active = false;          // on the round-robin list
+    };
+
+    SchedulerConfig cfg;
+    RateLimiter* limiter = nullptr;
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::unordered_map<std::string, std::unique_ptr<Flow>> flows;
+    std::deque<Flow*> active;
+    bool stopping = false;
+
+    Flow& flow_for(const std::string& key);
+};
@@ -1,118 +1,319 @@
 
 #include "server.hpp"
 #include "../core/ofs_core.hpp"
-#include <iostream>
+#include "json_writer.hpp"
+#include "metrics.hpp"
+#include "logger.hpp"
 #include <netinet/in.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <cerrno>
 #include <sstream>
-#include <regex>
-#include <iomanip>
-#include <ctime>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
 
-int r = -1;          
-std::string msg;      
-OFSServer::OFSServer() : server_fd(-1), running(false), fs_inst(nullptr) {}
+OFSServer::OFSServer() : running(false), inline_dispatch(false), fs_inst(nullptr) {}
 OFSServer::~OFSServer() { stop(); }
 
-bool OFSServer::start(uint16_t port, void* _fs_inst, uint32_t max_conn, uint32_t queue_tmo) {
+bool OFSServer::start(uint16_t port, void* _fs_inst, uint32_t max_conn, uint32_t queue_tmo,
+                      const std::string& unix_socket, uint32_t reactor_threads, const SchedulerConfig& sched) {
     fs_inst = _fs_inst;
+    sched_cfg = sched;
+    rate_limiter.configure(sched.rate_limit, sched.rate_burst);
+    for(RequestScheduler& lane : lanes) lane.configure(sched, &rate_limiter);
     this->max_connections = max_conn;
     this->queue_timeout = queue_tmo;
+    uint32_t n_reactors = reactor_threads ? reactor_threads : 1;
+    // With several reactors each owns a SO_REUSEPORT socket on the same port and the
+    // kernel spreads incoming connections across them.
+    inline_dispatch = n_reactors > 1;
 
-    server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if(server_fd < 0){ perror("socket"); return false; }
+    for(uint32_t i = 0; i < n_reactors; ++i){
+        std::unique_ptr<Reactor> r(new Reactor());
+        r->epoll_fd = epoll_create1(0);
+        if(r->epoll_fd < 0){ perror("epoll_create1"); return false; }
+        r->tcp_fd = listenTcp(port, n_reactors > 1);
+        if(r->tcp_fd < 0 || !watchListener(*r, r->tcp_fd)) return false;
+        // AF_UNIX has no SO_REUSEPORT; the first reactor takes all local connections.
+        if(i == 0 && !unix_socket.empty()){
+            r->unix_fd = listenUnix(unix_socket);
+            if(r->unix_fd < 0 || !watchListener(*r, r->unix_fd)) return false;
+        }
+        reactors.push_back(std::move(r));
+    }
+
+    running = true;
+    for(auto& r : reactors)
+        r->thread = std::thread(&OFSServer::reactorLoop, this, r.get());
+
+    for(uint32_t i = 0; i < std::max(sched.metadata_workers, 1u); ++i)
+        worker_threads.emplace_back(&OFSServer::workerLoop, this, &lanes[static_cast<size_t>(OpLane::METADATA)]);
+    for(uint32_t i = 0; i < std::max(sched.bulk_workers, 1u); ++i)
+        worker_threads.emplace_back(&OFSServer::workerLoop, this, &lanes[static_cast<size_t>(OpLane::BULK)]);
+
+    log_event(LogLevel::INFO, LogFields{}, "server started on port %u max_connections=%u queue_timeout=%us reactors=%u%s%s",
+              (unsigned)port, (unsigned)max_connections, (unsigned)queue_timeout, (unsigned)n_reactors,
+              unix_path.empty() ? "" : " unix_socket=", unix_path.c_str());
+
+    return true;
+}
+
+int OFSServer::listenTcp(uint16_t port, bool reuse_port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(fd < 0){ perror("socket"); return -1; }
 
     int opt = 1;
-    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if(reuse_port && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0){
+        perror("setsockopt(SO_REUSEPORT)"); close(fd); return -1;
+    }
 
     sockaddr_in addr{};
     addr.sin_family = AF_INET;
     addr.sin_addr.s_addr = INADDR_ANY;
     addr.sin_port = htons(port);
 
-    if(bind(server_fd, (sockaddr*)&addr, sizeof(addr)) < 0){ perror("bind"); return false; }
+    if(bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0){ perror("bind"); close(fd); return -1; }
 
-    if(listen(server_fd, max_connections) < 0){ perror("listen"); return false; }
+    if(listen(fd, max_connections) < 0){ perror("listen"); close(fd); return -1; }
+    net_set_nonblocking(fd);
+    return fd;
+}
 
-    running = true;
-    accept_thread = std::thread(&OFSServer::acceptLoop, this);
+// Same-host clients can connect here and skip the TCP stack; connections
+// share the event loop and protocol with TCP clients.
+int OFSServer::listenUnix(const std::string& path) {
+    sockaddr_un addr{};
+    if(path.size() >= sizeof(addr.sun_path)){ log_event(LogLevel::ERROR, LogFields{}, "unix socket path too long: %s", path.c_str()); return -1; }
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
 
-    
-    for(int i = 0; i < 4; ++i)
-        worker_threads.emplace_back(&OFSServer::workerLoop, this);
+    // A socket file left by a previous run would make bind fail; never remove anything else.
+    struct stat st{};
+    if(lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path.c_str());
 
-    std::cout << "[OFS] Server started on port " << port 
-              << " | Max connections: " << max_connections 
-              << " | Queue timeout: " << queue_timeout << "s\n";
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0){ perror("socket(AF_UNIX)"); return -1; }
+    if(bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0){ perror("bind(unix)"); close(fd); return -1; }
+    unix_path = path;
+    if(listen(fd, max_connections) < 0){ perror("listen(unix)"); close(fd); return -1; }
+    net_set_nonblocking(fd);
+    return fd;
+}
 
+bool OFSServer::watchListener(Reactor& r, int fd) {
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if(epoll_ctl(r.epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0){ perror("epoll_ctl"); return false; }
     return true;
 }
 
 void OFSServer::stop() {
     running = false;
-    if(server_fd >=0) close(server_fd);
-    if(accept_thread.joinable()) accept_thread.join();
+    for(RequestScheduler& lane : lanes) lane.shutdown();
+    for(auto& r : reactors) if(r->thread.joinable()) r->thread.join();
     for(auto &t: worker_threads) if(t.joinable()) t.join();
+    for(auto& r : reactors){
+        for(auto &kv : r->connections) net_close(*kv.second);
+        r->connections.clear();
+        if(r->tcp_fd >= 0) { close(r->tcp_fd); r->tcp_fd = -1; }
+        if(r->unix_fd >= 0) { close(r->unix_fd); r->unix_fd = -1; }
+        if(r->epoll_fd >= 0) { close(r->epoll_fd); r->epoll_fd = -1; }
+    }
+    reactors.clear();
+    if(!unix_path.empty()) { unlink(unix_path.c_str()); unix_path.clear(); }
 }
 
-void OFSServer::acceptLoop() {
-    fd_set master, read_fds;
-    FD_ZERO(&master);
-    FD_SET(server_fd, &master);
-    int max_fd = server_fd;
-    std::vector<int> clients;
+void OFSServer::reactorLoop(Reactor* r) {
+    const int MAX_EVENTS = 64;
+    epoll_event events[MAX_EVENTS];
 
     while(running){
-        read_fds = master;
-        timeval tv{1,0};
-        int ret = select(max_fd+1, &read_fds, nullptr, nullptr, &tv);
-        if(ret < 0) continue;
-
-        if(FD_ISSET(server_fd, &read_fds)){
-            sockaddr_in cli_addr{};
-            socklen_t len = sizeof(cli_addr);
-            int cli_fd = accept(server_fd,(sockaddr*)&cli_addr,&len);
-            if(cli_fd >= 0){
-                fcntl(cli_fd, F_SETFL, O_NONBLOCK);
-                FD_SET(cli_fd,&master);
-                if(cli_fd>max_fd) max_fd = cli_fd;
-                clients.push_back(cli_fd);
-                std::cout << "[OFS] New client FD=" << cli_fd << "\n";
+        int n = epoll_wait(r->epoll_fd, events, MAX_EVENTS, 1000);
+        if(n < 0) continue;
+
+        for(int i = 0; i < n; ++i){
+            int fd = events[i].data.fd;
+            if(fd == r->tcp_fd || fd == r->unix_fd){
+                acceptClients(*r, fd);
+                continue;
+            }
+            auto it = r->connections.find(fd);
+            if(it == r->connections.end()) continue;
+            std::shared_ptr<ClientConnection> conn = it->second;
+            uint32_t e = events[i].events;
+            if(e & EPOLLOUT){
+                std::function<void()> resume;
+                if(!net_on_writable(*conn, resume)){ closeClient(*r, fd); continue; }
+                if(resume) resume();
+            }
+            if(e & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)){
+                readClient(*r, conn);
             }
         }
+        // A finished download's last ranges are only released by a later flush; connections
+        // that have gone quiet since get them released here.
+        uint64_t now = metrics_now_ns();
+        if(now - r->sent_sweep_ns >= 1000000000ull){
+            r->sent_sweep_ns = now;
+            for(auto& kv : r->connections) net_release_sent(*kv.second);
+        }
+    }
+}
 
-        char buffer[4096];
-        for(auto it=clients.begin(); it!=clients.end();){
-            int fd = *it;
-            if(FD_ISSET(fd,&read_fds)){
-                ssize_t n = recv(fd, buffer,sizeof(buffer)-1,0);
-                if(n<=0){
-                    close(fd);
-                    std::lock_guard<std::mutex> lock(session_mtx);
-                    client_sessions.erase(fd);
-                    it = clients.erase(it);
-                    continue;
-                }
-                std::string s(buffer,n);
-                std::istringstream iss(s);
-                std::string line;
-
-                while (std::getline(iss, line)) {
-                    if (line.empty()) continue;
-                    std::vector<std::string> tokens = parseArgs(line);
-                    if (tokens.empty()) continue;
-
-                    OFSRequest req;
-                    req.client_fd = fd;
-                    req.cmd = tokens[0];
-                    req.args.assign(tokens.begin() + 1, tokens.end());
-                    op_queue.push(req);
-                }
-            }
-            ++it;
+void OFSServer::acceptClients(Reactor& r, int listen_fd) {
+    while(true){
+        sockaddr_storage cli_addr{};
+        socklen_t len = sizeof(cli_addr);
+        int cli_fd = accept(listen_fd,(sockaddr*)&cli_addr,&len);
+        if(cli_fd < 0) return;
+        net_set_nonblocking(cli_fd);
+        auto conn = std::make_shared<ClientConnection>(cli_fd, r.epoll_fd);
+        if(!net_register(*conn)){ close(cli_fd); continue; }
+        r.connections[cli_fd] = conn;
+        metrics_add(metrics_local().connections_accepted, 1);
+        log_event(LogLevel::INFO, LogFields{cli_fd}, "client connected");
+    }
+}
+
+void OFSServer::closeClient(Reactor& r, int fd) {
+    auto it = r.connections.find(fd);
+    if(it == r.connections.end()) return;
+    std::shared_ptr<ClientConnection> conn = it->second;
+    r.connections.erase(it);
+    log_event(LogLevel::INFO, LogFields{fd}, "client disconnected");
+    net_close(*conn);
+    std::lock_guard<std::mutex> lock(conn->req_mtx);
+    conn->pending.clear();
+}
+
+void OFSServer::readClient(Reactor& r, const std::shared_ptr<ClientConnection>& conn) {
+    char buffer[16384];
+    bool eof = false;
+    while(true){
+        ssize_t n = recv(conn->fd, buffer, sizeof(buffer), 0);
+        if(n > 0){
+            metrics_add(metrics_local().bytes_in, static_cast<uint64_t>(n));
+            conn->in_buf.append(buffer, n);
+            if(n < (ssize_t)sizeof(buffer) || conn->in_buf.size() >= READ_BUDGET) break;
+            continue;
+        }
+        if(n < 0 && errno == EINTR) continue;
+        if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        eof = true;
+        break;
+    }
+
+    size_t start = 0;
+    bool bad = false;
+    while(true){
+        size_t nl = conn->in_buf.find('\n', start);
+        if(nl == std::string::npos) break;
+        size_t line_start = start;
+        std::string line = conn->in_buf.substr(start, nl - start);
+        start = nl + 1;
+        if(!line.empty() && line.back() == '\r') line.pop_back();
+        if(line.empty()) continue;
+        std::vector<std::string> tokens = parseArgs(line);
+        if(tokens.empty()) continue;
+
+        OFSRequest req;
+        req.client_fd = conn->fd;
+        req.conn = conn;
+        size_t first = 0;
+        if(tokens[0].size() > 1 && tokens[0][0] == '#'){
+            req.request_id = tokens[0].substr(1);
+            first = 1;
+        } else {
+            req.request_id = "0";
         }
+        if(first >= tokens.size()) continue;
+        req.cmd = tokens[first];
+        req.opcode = lookup_opcode(req.cmd);
+        req.args.assign(tokens.begin() + first + 1, tokens.end());
+        if(req.opcode == OFSOpcode::UPLOAD_CHUNK){
+            // "upload_chunk <n>" is followed by exactly n raw bytes.
+            char* end = nullptr;
+            unsigned long long len = req.args.empty() ? 0 : std::strtoull(req.args[0].c_str(), &end, 10);
+            if(req.args.empty() || *end != '\0' || len > MAX_UPLOAD_CHUNK){ bad = true; break; }
+            if(conn->in_buf.size() - start < len){ start = line_start; break; }
+            req.body.assign(conn->in_buf, start, len);
+            start += len;
+        }
+        submitRequest(std::move(req));
+    }
+    conn->in_buf.erase(0, start);
+
+    if(eof || bad || conn->in_buf.size() > MAX_REQUEST_LINE) closeClient(r, conn->fd);
+}
+
+void OFSServer::submitRequest(OFSRequest&& req) {
+    ClientConnection& conn = *req.conn;
+    std::unique_lock<std::mutex> lock(conn.req_mtx);
+    conn.queued_body_bytes += req.body.size();
+    if(conn.in_flight){
+        conn.pending.push_back(std::move(req));
+        if(conn.pending.size() >= MAX_PIPELINE_DEPTH || conn.queued_body_bytes >= MAX_QUEUED_BODY_BYTES)
+            net_set_input_paused(conn, true);
+        return;
     }
+    conn.in_flight = true;
+    CoreLock core{fs_inst};
+    std::unique_lock<CoreLock> core_lock(core, std::defer_lock);
+    if(!mayRunInline(req, core_lock)){
+        enqueueRequest(req);
+        return;
+    }
+    lock.unlock();
+    // Sharded mode: run the request on the reactor that parsed it.
+    bool done = handleRequest(req);
+    core_lock.unlock();
+    if(done) completeRequest(req);
+}
+
+bool CoreLock::try_lock() { return fs_try_lock(fs) != 0; }
+void CoreLock::unlock() { fs_unlock(fs); }
+
+// Called with the connection's req_mtx held, which orders it after the login that set user/admin.
+// On success core_lock owns the core lock, which the request's API calls then re-enter.
+bool OFSServer::mayRunInline(const OFSRequest& req, std::unique_lock<CoreLock>& core_lock) {
+    if(!inline_dispatch || OP_HANDLERS[static_cast<size_t>(req.opcode)].lane != OpLane::METADATA) return false;
+    // The reactor must not wait behind a long call holding the core lock, stalling every
+    // connection it serves; when the lock is taken the request goes to a metadata worker instead.
+    if(!core_lock.try_lock()) return false;
+    // A user over their rate limit waits in the scheduler instead of running now.
+    if(rate_limiter.try_take(req.conn->user, metrics_now_ns()) == 0) return true;
+    core_lock.unlock();
+    return false;
+}
+
+void OFSServer::enqueueRequest(OFSRequest& req) {
+    req.enqueued_ns = metrics_now_ns();
+    metrics_queue_depth_add(1);
+    ClientConnection& conn = *req.conn;
+    RequestScheduler& lane = lanes[static_cast<size_t>(OP_HANDLERS[static_cast<size_t>(req.opcode)].lane)];
+    lane.push(std::move(req), conn.user, conn.admin ? sched_cfg.admin_weight : sched_cfg.user_weight);
+}
+
+void OFSServer::completeRequest(const OFSRequest& done) {
+    ClientConnection& conn = *done.conn;
+    std::lock_guard<std::mutex> lock(conn.req_mtx);
+    conn.queued_body_bytes -= done.body.size();
+    if(conn.pending.empty()){
+        conn.in_flight = false;
+    } else {
+        enqueueRequest(conn.pending.front());
+        conn.pending.pop_front();
+    }
+    // input_paused is only changed under req_mtx, so reading it here is safe.
+    if(conn.input_paused && conn.pending.size() <= MAX_PIPELINE_DEPTH / 2 &&
+       conn.queued_body_bytes <= MAX_QUEUED_BODY_BYTES / 2)
+        net_set_input_paused(conn, false);
 }
 
 std::vector<std::string> OFSServer::parseArgs(const std::string& line) {
@@ -141,266 +342,1037 @@ std::vector<std::string> OFSServer::parseArgs(const std::string& line) {
 }
 
 
-std::string OFSServer::make_response_json(const std::string& status,const std::string& op,const std::string& error,const std::string& data){
-    std::string res = "{\"status\":\""+status+"\",\"operation\":\""+op+"\",\"request_id\":\"0\",\"error_message\":\""+error+"\"";
-    if(!data.empty()) {
-      
-        std::string d = data;
-       
-        std::string out;
-        for(char ch : d){
-            if(ch == '\\') out += "\\\\";
-            else if(ch == '"') out += "\\\"";
-            else if(ch == '\n') out += "\\n";
-            else out += ch;
-        }
-        res += ",\"data\":\""+ out + "\"";
+void OFSServer::write_response_json(std::string& out, bool ok, const OFSRequest& req, const OFSCall& call){
+    JsonWriter w(out);
+    w.begin_object();
+    w.field("status", ok ? "success" : "error");
+    w.field("operation", req.cmd);
+    w.field("request_id", req.request_id);
+    w.field("error_message", call.msg);
+    if(!call.etag.empty()) w.field("etag", call.etag);
+    if(!call.data_json.empty()) {
+        w.key("data").raw(call.data_json);
+    } else if(call.blob) {
+        w.key("data").value(call.blob, call.blob_len);
+    } else if(!call.data.empty()) {
+        w.field("data", call.data);
     }
-    res+="}";
-    return res;
+    w.end_object();
+    out.push_back('\n');
 }
 
-void OFSServer::workerLoop(){
-    while(running){
+void OFSServer::workerLoop(RequestScheduler* lane){
+    while(true){
         OFSRequest req;
-        if(op_queue.pop(req))
-            handleRequest(req);
-    }
-}
-
-static std::string fmt_time(uint64_t t) {
-    if(t == 0) return "0";
-    std::time_t tt = (time_t)t;
-    char buf[64];
-#if defined(__APPLE__) || defined(__MACH__)
-    std::tm *tmv = localtime(&tt);
-    if(tmv) std::strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", tmv);
-#else
-    std::tm tmv;
-    localtime_r(&tt, &tmv);
-    std::strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tmv);
-#endif
-    return std::string(buf);
-}
-
-void OFSServer::handleRequest(const OFSRequest& req){
-    OFSResponse resp;
-    resp.client_fd = req.client_fd;
-    std::string op = req.cmd;
-    std::string data, msg;
-    void* session = nullptr;
-    {
-        std::lock_guard<std::mutex> lock(session_mtx);
-        if(client_sessions.count(req.client_fd)) session = client_sessions[req.client_fd];
+        if(!lane->pop(req)) return;
+        metrics_queue_depth_add(-1);
+        metrics_record(metrics_local().queue_wait, metrics_now_ns() - req.enqueued_ns);
+        if(handleRequest(req)) completeRequest(req);
     }
+}
 
+// Indexed by OFSOpcode; UNKNOWN has no handler. Operations that move file contents run on
+// the bulk lane so they never queue ahead of metadata lookups.
+const OFSServer::OpHandlerEntry OFSServer::OP_HANDLERS[] = {
+    {nullptr, 0, OpLane::METADATA},
+    {&OFSServer::opLogin, 2, OpLane::METADATA},
+    {&OFSServer::opLogout, 0, OpLane::METADATA},
+    {&OFSServer::opCreateUser, 3, OpLane::METADATA},
+    {&OFSServer::opDeleteUser, 1, OpLane::METADATA},
+    {&OFSServer::opListUsers, 0, OpLane::METADATA},
+    {&OFSServer::opCreateDir, 1, OpLane::METADATA},
+    {&OFSServer::opDeleteDir, 1, OpLane::METADATA},
+    {&OFSServer::opDirExists, 1, OpLane::METADATA},
+    {&OFSServer::opDirList, 1, OpLane::METADATA},
+    {&OFSServer::opCreateFile, 2, OpLane::BULK},
+    {&OFSServer::opReadFile, 1, OpLane::BULK},
+    {&OFSServer::opEditFile, 3, OpLane::BULK},
+    {&OFSServer::opTruncateFile, 2, OpLane::BULK},
+    {&OFSServer::opRenameFile, 2, OpLane::METADATA},
+    {&OFSServer::opDeleteFile, 1, OpLane::BULK},
+    {&OFSServer::opGetMetadata, 1, OpLane::METADATA},
+    {&OFSServer::opSetPermissions, 2, OpLane::METADATA},
+    {&OFSServer::opSetOwner, 2, OpLane::METADATA},
+    {&OFSServer::opGetSessionInfo, 0, OpLane::METADATA},
+    {&OFSServer::opDownload, 1, OpLane::BULK},
+    {&OFSServer::opUploadBegin, 1, OpLane::BULK},
+    {&OFSServer::opUploadChunk, 1, OpLane::BULK},
+    {&OFSServer::opUploadCommit, 0, OpLane::BULK},
+    {&OFSServer::opUploadAbort, 0, OpLane::BULK},
+    {&OFSServer::opMetrics, 0, OpLane::METADATA},
+    {&OFSServer::opBatch, 2, OpLane::BULK},
+    {&OFSServer::opFileOpen, 1, OpLane::METADATA},
+    {&OFSServer::opHandleRead, 3, OpLane::BULK},
+    {&OFSServer::opHandleWrite, 3, OpLane::BULK},
+    {&OFSServer::opHandleStat, 1, OpLane::METADATA},
+    {&OFSServer::opFileClose, 1, OpLane::METADATA},
+    {&OFSServer::opPrefixList, 1, OpLane::METADATA},
+    {&OFSServer::opFind, 1, OpLane::BULK},
+    {&OFSServer::opDeleteTree, 1, OpLane::BULK},
+    {&OFSServer::opCopyTree, 2, OpLane::BULK},
+    {&OFSServer::opWatch, 1, OpLane::METADATA},
+    {&OFSServer::opUnwatch, 1, OpLane::METADATA},
+    {&OFSServer::opLease, 1, OpLane::BULK},
+    {&OFSServer::opUnlease, 1, OpLane::METADATA},
+    {&OFSServer::opReadIf, 2, OpLane::BULK},
+};
+bool OFSServer::handleRequest(OFSRequest& req){
+    static_assert(sizeof(OP_HANDLERS) / sizeof(OP_HANDLERS[0]) == static_cast<size_t>(OFSOpcode::COUNT),
+                  "OP_HANDLERS must have one entry per opcode");
+    if(!req.started_ns) req.started_ns = metrics_now_ns();
     int r = -1;
-    if(op=="login" && req.args.size()>=2){
-        r = user_login(&session,req.args[0].c_str(),req.args[1].c_str());
-        if(r==0){
-            std::lock_guard<std::mutex> lock(session_mtx);
-            client_sessions[req.client_fd] = session;
+    const OpHandlerEntry& h = OP_HANDLERS[static_cast<size_t>(req.opcode)];
+    while(true){
+        OFSCall call(req, *req.conn, json_thread_buffer(1));
+        if(h.fn && req.args.size() >= h.min_args){
+            r = (this->*h.fn)(call);
+            if(call.msg.empty()) call.msg = get_error_message(r);
+        } else {
+            r = static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+            call.msg = "Unknown command or wrong arguments";
+        }
+
+        if(!call.responded){
+            std::string& out = json_thread_buffer(0);
+            write_response_json(out, r == 0, req, call);
+            if(call.blob) free_buffer(call.blob);
+            sendResponse(*req.conn, out);
         }
-        msg = get_error_message(r);
+        if(!call.suspend) break;
+
+        // The client has not read what was sent so far. Give the thread back and let the
+        // reactor requeue the request once the output drains; if it already has, go on here.
+        req.resume = std::move(call.suspend);
+        std::shared_ptr<OFSRequest> parked = std::make_shared<OFSRequest>(std::move(req));
+        ClientConnection& conn = *parked->conn;
+        if(net_park_until_drained(conn, [this, parked]{ enqueueRequest(*parked); })) return false;
+        req = std::move(*parked);
     }
-    else if(op=="logout"){
-        if(session){
-            r = user_logout(session);
-            std::lock_guard<std::mutex> lock(session_mtx);
-            client_sessions.erase(req.client_fd);
-        } else {
-            r = static_cast<int>(OFSErrorCodes::ERROR_INVALID_SESSION);
+    req.resume.reset();
+
+    uint64_t elapsed_ns = metrics_now_ns() - req.started_ns;
+    OpMetrics& m = metrics_local().ops[static_cast<size_t>(req.opcode)];
+    if(r != 0) metrics_add(m.errors, 1);
+    metrics_record(m.latency, elapsed_ns);
+    if(log_enabled(LogLevel::DEBUG))
+        log_event(LogLevel::DEBUG, LogFields{req.conn->fd, req.conn->user.c_str(), req.opcode, static_cast<int64_t>(elapsed_ns)},
+                  "request #%s %s", req.request_id.c_str(), r == 0 ? "ok" : get_error_message(r));
+    return true;
+}
+
+int OFSServer::opLogin(OFSCall& c){
+    void* session = nullptr;
+    int r = user_login(&session, c.req.args[0].c_str(), c.req.args[1].c_str());
+    if(r==0){
+        SessionInfo info;
+        c.conn.session = session;
+        c.conn.user = c.req.args[0];
+        c.conn.admin = get_session_info(session, &info) == 0 && info.user.role == UserRole::ADMIN;
+    }
+    return r;
+}
+
+int OFSServer::opLogout(OFSCall& c){
+    void* session = c.conn.session.exchange(nullptr);
+    if(!session) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_SESSION);
+    // An unfinished upload refers to the session being closed.
+    if(c.conn.upload){ file_upload_abort(c.conn.upload); c.conn.upload = nullptr; }
+    for(void* h : c.conn.handles) if(h) file_close(h);
+    c.conn.handles.clear();
+    for(auto& w : c.conn.watches) if(w) fs_watch_remove(w->watch);
+    c.conn.watches.clear();
+    for(auto& l : c.conn.leases) if(l) fs_watch_remove(l->watch);
+    c.conn.leases.clear();
+    c.conn.user.clear();
+    c.conn.admin = false;
+    return user_logout(session);
+}
+
+int OFSServer::opCreateUser(OFSCall& c){
+    UserRole role = (c.req.args[2]=="admin") ? UserRole::ADMIN : UserRole::NORMAL;
+    return user_create(c.conn.session,c.req.args[0].c_str(),c.req.args[1].c_str(),role);
+}
+
+int OFSServer::opDeleteUser(OFSCall& c){
+    void* session = c.conn.session;
+    if(!session) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_SESSION);
+    return user_delete(session, c.req.args[0].c_str());
+}
+
+int OFSServer::opListUsers(OFSCall& c){
+    UserInfo* users=nullptr; int count=0;
+    int r = user_list(c.conn.session,&users,&count);
+    if(r==0){
+        JsonWriter w(c.data_json);
+        w.begin_array();
+        for(int i=0;i<count;i++) {
+            w.begin_object();
+            w.field("username", users[i].username);
+            w.field("role", (users[i].role==UserRole::ADMIN) ? "admin" : "normal");
+            w.end_object();
         }
-        msg = get_error_message(r);
+        w.end_array();
+        free_buffer(users);
+    }
+    return r;
+}
+
+int OFSServer::opCreateDir(OFSCall& c){
+    return dir_create(c.conn.session,c.req.args[0].c_str());
+}
+
+int OFSServer::opDeleteDir(OFSCall& c){
+    return dir_delete(c.conn.session,c.req.args[0].c_str());
+}
+
+int OFSServer::opDeleteTree(OFSCall& c){
+    return dir_delete_tree(c.conn.session,c.req.args[0].c_str());
+}
+
+int OFSServer::opCopyTree(OFSCall& c){
+    return dir_copy_tree(c.conn.session,c.req.args[0].c_str(),c.req.args[1].c_str());
+}
+
+int OFSServer::opDirExists(OFSCall& c){
+    int rc = dir_exists(c.conn.session, c.req.args[0].c_str());
+    c.data = (rc == static_cast<int>(OFSErrorCodes::SUCCESS)) ? "true" : "false";
+    c.msg = get_error_message(rc);
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
+}
+
+static bool parse_u64(const std::string& s, uint64_t& v){
+    char* end = nullptr;
+    if(s.empty() || s[0] == '-') return false;
+    errno = 0;
+    v = std::strtoull(s.c_str(), &end, 10);
+    return *end == '\0' && errno == 0;
+}
+
+// Page cursors are opaque to clients and travel as hex, so any name survives argument splitting.
+static std::string cursor_encode(const char* raw){
+    static const char HEX[] = "0123456789abcdef";
+    std::string hex;
+    for(const char* p = raw; p && *p; ++p){
+        hex.push_back(HEX[static_cast<uint8_t>(*p) >> 4]);
+        hex.push_back(HEX[static_cast<uint8_t>(*p) & 15]);
     }
-    else if(op=="create_user" && req.args.size()>=3){
-        UserRole role = (req.args[2]=="admin") ? UserRole::ADMIN : UserRole::NORMAL;
-        r = user_create(session,req.args[0].c_str(),req.args[1].c_str(),role);
-        msg = get_error_message(r);
+    return hex;
+}
+
+static bool cursor_decode(const std::string& hex, std::string& raw){
+    auto nibble = [](char ch) { return (ch >= '0' && ch <= '9') ? ch - '0' : (ch >= 'a' && ch <= 'f') ? ch - 'a' + 10 : -1; };
+    if(hex.size() % 2) return false;
+    raw.clear();
+    for(size_t j = 0; j < hex.size(); j += 2){
+        int hi = nibble(hex[j]), lo = nibble(hex[j + 1]);
+        if(hi < 0 || lo < 0) return false;
+        raw.push_back(static_cast<char>(hi << 4 | lo));
+    }
+    return true;
+}
+
+// ETags are "<inode>-<version>"; see OFSVersionTag.
+static std::string etag_encode(uint32_t inode, uint64_t version){
+    return std::to_string(inode) + "-" + std::to_string(version);
+}
+
+static bool etag_decode(const std::string& s, OFSVersionTag& tag){
+    size_t dash = s.find('-');
+    uint64_t inode;
+    if(dash == std::string::npos || !parse_u64(s.substr(0, dash), inode) || inode > UINT32_MAX) return false;
+    tag.inode = static_cast<uint32_t>(inode);
+    return parse_u64(s.substr(dash + 1), tag.version);
+}
+
+// Paged form of dir_list: parses [limit=N] [cursor=C] [compact] and writes one page.
+static int dir_list_paged(OFSCall& c){
+    uint64_t limit = PAGE_DEFAULT_LIMIT;
+    std::string cursor;
+    bool compact = false;
+    for(size_t i = 1; i < c.req.args.size(); i++){
+        const std::string& a = c.req.args[i];
+        bool ok = true;
+        if(a == "compact") compact = true;
+        else if(a.compare(0, 6, "limit=") == 0) ok = parse_u64(a.substr(6), limit) && limit > 0 && limit <= PAGE_MAX_LIMIT;
+        else if(a.compare(0, 7, "cursor=") == 0) ok = cursor_decode(a.substr(7), cursor);
+        else ok = false;
+        if(!ok){
+            c.msg = "Bad dir_list argument: " + a;
+            return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+        }
     }
-    
-else if(op == "delete_user" && req.args.size() >= 1){
-    if(!session){
-        r = static_cast<int>(OFSErrorCodes::ERROR_INVALID_SESSION);
+    int count = 0;
+    char* next = nullptr;
+    JsonWriter w(c.data_json);
+    int r;
+    if(compact){
+        OFSNameEntry* names = nullptr;
+        r = dir_list_names(c.conn.session, c.req.args[0].c_str(), cursor.c_str(), static_cast<int>(limit), &names, &count, &next);
+        if(r != 0) return r;
+        w.begin_object();
+        w.key("entries");
+        w.begin_array();
+        std::string name;
+        for(int i=0;i<count;i++){
+            name.assign(names[i].name, strnlen(names[i].name, sizeof(names[i].name)));
+            if(names[i].type == static_cast<uint8_t>(EntryType::DIRECTORY)) name.push_back('/');
+            w.value(name);
+        }
+        w.end_array();
+        free_buffer(names);
     } else {
-        const std::string& username_to_delete = req.args[0];
-        r = user_delete(session, username_to_delete.c_str());
+        FileEntry* entries = nullptr;
+        r = dir_list_page(c.conn.session, c.req.args[0].c_str(), cursor.c_str(), static_cast<int>(limit), &entries, &count, &next);
+        if(r != 0) return r;
+        w.begin_object();
+        w.key("entries");
+        w.begin_array();
+        for(int i=0;i<count;i++){
+            const FileEntry& e = entries[i];
+            w.begin_object();
+            w.field("name", e.name);
+            w.field("type", (e.type == static_cast<uint8_t>(EntryType::DIRECTORY)) ? "directory" : "file");
+            w.field("size", e.size);
+            w.field("owner", e.owner);
+            w.field("permissions", e.permissions);
+            w.field("created", e.created_time);
+            w.field("modified", e.modified_time);
+            w.field("inode", e.inode);
+            w.end_object();
+        }
+        w.end_array();
+        free_buffer(entries);
     }
-    msg = get_error_message(r);
+    w.field("cursor", cursor_encode(next));
+    w.end_object();
+    free_buffer(next);
+    return r;
 }
 
-    else if(op=="list_users"){
-        UserInfo* users=nullptr; int count=0;
-        r = user_list(session,&users,&count);
-        if(r==0 && users){
-            for(int i=0;i<count;i++) {
-                data+=std::string(users[i].username);
-                data += (users[i].role==UserRole::ADMIN) ? " (admin)\n":"\n";
-            }
-            free_buffer(users);
-        }
-        msg = get_error_message(r);
+// Serves a read-only reply from response_cache when the target has not changed since it
+// was cached. Otherwise returns false with the generation to store the fresh reply under
+// (inode 0 when the path could not be resolved, in which case nothing is stored).
+bool OFSServer::cachedReply(OFSCall& c, uint32_t& inode, uint64_t& generation){
+    inode = 0;
+    if(get_generation(c.conn.session, c.req.args[0].c_str(), &inode, &generation) != 0){
+        inode = 0;
+        return false;
     }
+    bool hit = response_cache.lookup(c.req.opcode, inode, generation, c.req.args[0], c.data_json);
+    metrics_add(hit ? metrics_local().cache_hits : metrics_local().cache_misses, 1);
+    return hit;
+}
 
-    else if(op=="create_dir" && req.args.size()>=1){
-        r = dir_create(session,req.args[0].c_str());
-        msg = get_error_message(r);
+// dir_list <path> [limit=N] [cursor=C] [compact]: without options every child, as an array.
+// With any option one page in name order, {"entries":[...],"cursor":"..."}, where compact
+// entries are bare names and directories end in '/'.
+int OFSServer::opDirList(OFSCall& c){
+    if(c.req.args.size() > 1) return dir_list_paged(c);
+    uint32_t inode;
+    uint64_t generation;
+    if(cachedReply(c, inode, generation)) return static_cast<int>(OFSErrorCodes::SUCCESS);
+    FileEntry* entries = nullptr;
+    int count = 0;
+    int r = dir_list(c.conn.session, c.req.args[0].c_str(), &entries, &count);
+    if(r==0){
+        JsonWriter w(c.data_json);
+        w.begin_array();
+        for(int i=0;i<count;i++){
+            const FileEntry& e = entries[i];
+            w.begin_object();
+            w.field("name", e.name);
+            w.field("type", (e.type == static_cast<uint8_t>(EntryType::DIRECTORY)) ? "directory" : "file");
+            w.field("size", e.size);
+            w.field("owner", e.owner);
+            w.field("permissions", e.permissions);
+            w.field("created", e.created_time);
+            w.field("modified", e.modified_time);
+            w.field("inode", e.inode);
+            w.end_object();
+        }
+        w.end_array();
+        free_buffer(entries);
+        if(inode) response_cache.store(c.req.opcode, inode, generation, c.req.args[0], c.data_json);
     }
-    else if(op=="delete_dir" && req.args.size()>=1){
-        r = dir_delete(session,req.args[0].c_str());
-        msg = get_error_message(r);
+    return r;
+}
+
+// prefix_list <prefix> [subtree]: entries whose path starts with prefix within its directory.
+int OFSServer::opPrefixList(OFSCall& c){
+    bool subtree = c.req.args.size() > 1 && c.req.args[1] == "subtree";
+    FileEntry* entries = nullptr;
+    int count = 0;
+    int r = path_prefix_scan(c.conn.session, c.req.args[0].c_str(), subtree ? 1 : 0, &entries, &count);
+    if(r==0){
+        JsonWriter w(c.data_json);
+        w.begin_array();
+        for(int i=0;i<count;i++){
+            const FileEntry& e = entries[i];
+            w.begin_object();
+            w.field("path", e.name);
+            w.field("type", (e.type == static_cast<uint8_t>(EntryType::DIRECTORY)) ? "directory" : "file");
+            w.field("size", e.size);
+            w.field("inode", e.inode);
+            w.end_object();
+        }
+        w.end_array();
+        free_buffer(entries);
     }
-    else if(op=="dir_exists" && req.args.size()>=1){
-       
-        int rc = dir_exists(session, req.args[0].c_str());
-        if(rc == static_cast<int>(OFSErrorCodes::SUCCESS)) data = "true";
-        else data = "false";
-        r = static_cast<int>(OFSErrorCodes::SUCCESS);
-        msg = get_error_message(rc);
+    return r;
+}
+
+// find <root> [name=<glob>] [type=file|dir] [min_size=N] [max_size=N] [owner=<user>]
+// [after=T] [before=T] [limit=N] [cursor=C]: one page of matching entries below root plus
+// the cursor for the next page ("" once the walk is done).
+int OFSServer::opFind(OFSCall& c){
+    OFSFindFilter f;
+    std::memset(&f, 0, sizeof(f));
+    uint64_t limit = PAGE_DEFAULT_LIMIT;
+    std::string cursor;
+    for(size_t i = 1; i < c.req.args.size(); i++){
+        const std::string& a = c.req.args[i];
+        size_t eq = a.find('=');
+        std::string k = a.substr(0, eq);
+        std::string v = eq == std::string::npos ? std::string() : a.substr(eq + 1);
+        bool ok = true;
+        if(eq == std::string::npos) ok = false;
+        else if(k == "name") f.name = c.req.args[i].c_str() + eq + 1;
+        else if(k == "owner") f.owner = c.req.args[i].c_str() + eq + 1;
+        else if(k == "type") { f.type = v == "file" ? 1 : v == "dir" ? 2 : 0; ok = f.type != 0; }
+        else if(k == "min_size") ok = parse_u64(v, f.min_size);
+        else if(k == "max_size") ok = parse_u64(v, f.max_size);
+        else if(k == "after") ok = parse_u64(v, f.modified_after);
+        else if(k == "before") ok = parse_u64(v, f.modified_before);
+        else if(k == "limit") ok = parse_u64(v, limit) && limit > 0 && limit <= PAGE_MAX_LIMIT;
+        else if(k == "cursor") ok = cursor_decode(v, cursor);
+        else ok = false;
+        if(!ok){
+            c.msg = "Bad find argument: " + a;
+            return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+        }
     }
-   
-else if(op=="dir_list" && req.args.size()>=1){
-    FileEntry* entries = nullptr; 
+    FileEntry* entries = nullptr;
     int count = 0;
-    r = dir_list(session, req.args[0].c_str(), &entries, &count);
-    if(r==0 && entries){
-        std::ostringstream oss;
+    char* next = nullptr;
+    int r = fs_find(c.conn.session, c.req.args[0].c_str(), &f, cursor.c_str(), static_cast<int>(limit), &entries, &count, &next);
+    if(r==0){
+        JsonWriter w(c.data_json);
+        w.begin_object();
+        w.key("entries");
+        w.begin_array();
         for(int i=0;i<count;i++){
-            // Escape any double quotes or backslashes
-            std::string name = entries[i].name;
-            for(size_t j=0;j<name.size();j++){
-                if(name[j]=='"' || name[j]=='\\'){
-                    oss << '\\';
-                }
-                oss << name[j];
-            }
-            if(entries[i].type == static_cast<uint8_t>(EntryType::DIRECTORY)) oss << "/"; 
-            oss << "  \t" << entries[i].size << " bytes";
-            oss << " \towner:" << entries[i].owner;
-            oss << " \tperm:" << entries[i].permissions;
-            oss << "\\n"; // escape newline for JSON string
+            const FileEntry& e = entries[i];
+            w.begin_object();
+            w.field("path", e.name);
+            w.field("type", (e.type == static_cast<uint8_t>(EntryType::DIRECTORY)) ? "directory" : "file");
+            w.field("size", e.size);
+            w.field("owner", e.owner);
+            w.field("modified", e.modified_time);
+            w.field("inode", e.inode);
+            w.end_object();
         }
-        data = oss.str();
+        w.end_array();
+        w.field("cursor", cursor_encode(next));
+        w.end_object();
         free_buffer(entries);
+        free_buffer(next);
+    }
+    return r;
+}
+
+int OFSServer::opCreateFile(OFSCall& c){
+    const std::string& body = c.req.args[1];
+    return file_create(c.conn.session,c.req.args[0].c_str(),body.c_str(), body.size());
+}
+
+int OFSServer::opReadFile(OFSCall& c){
+    char* buf=nullptr; size_t sz=0;
+    OFSVersionTag tag;
+    int r = file_read_tagged(c.conn.session,c.req.args[0].c_str(),nullptr,&buf,&sz,&tag);
+    if(r==0 && buf){
+        c.blob = buf;
+        c.blob_len = sz;
+        c.etag = etag_encode(tag.inode, tag.version);
+    }
+    return r;
+}
+
+// read_if <path> <etag>: {"not_modified":true,"etag"} while the file still has that tag,
+// otherwise {"not_modified":false,"etag","content"}.
+int OFSServer::opReadIf(OFSCall& c){
+    OFSVersionTag want;
+    if(!etag_decode(c.req.args[1], want)){
+        c.msg = "Bad etag: " + c.req.args[1];
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    }
+    char* buf=nullptr; size_t sz=0;
+    OFSVersionTag tag;
+    int r = file_read_tagged(c.conn.session,c.req.args[0].c_str(),&want,&buf,&sz,&tag);
+    if(r!=0) return r;
+    JsonWriter w(c.data_json);
+    w.begin_object();
+    w.field("not_modified", buf == nullptr);
+    w.field("etag", etag_encode(tag.inode, tag.version));
+    if(buf) w.key("content").value(buf, sz);
+    w.end_object();
+    free_buffer(buf);
+    return r;
+}
+
+int OFSServer::opEditFile(OFSCall& c){
+    try {
+        unsigned int idx = std::stoul(c.req.args[2]);
+        const std::string& new_data = c.req.args[1];
+        return file_edit(c.conn.session, c.req.args[0].c_str(), new_data.c_str(), new_data.size(), idx);
+    } catch (const std::exception& e) {
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    }
+}
+
+int OFSServer::opTruncateFile(OFSCall& c){
+    try {
+        unsigned long sz = std::stoul(c.req.args[1]);
+        return file_truncate(c.conn.session, c.req.args[0].c_str(), sz);
+    } catch (...) {
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
     }
-    msg = get_error_message(r);
 }
-    else if(op=="create_file" && req.args.size()>=2){
-        r = file_create(session,req.args[0].c_str(),req.args[1].c_str(), req.args[1].size());
-        msg = get_error_message(r);
+
+int OFSServer::opRenameFile(OFSCall& c){
+    const std::string& old_path = c.req.args[0];
+    const std::string& new_path = c.req.args[1];
+    int r = file_rename(c.conn.session, old_path.c_str(), new_path.c_str());
+    if(r != 0) {
+        log_event(LogLevel::WARN, LogFields{c.conn.fd, c.conn.user.c_str(), OFSOpcode::RENAME_FILE},
+                  "rename_file failed: %s -> %s code=%d msg=%s", old_path.c_str(), new_path.c_str(), r, get_error_message(r));
+    }
+    return r;
+}
+
+int OFSServer::opDeleteFile(OFSCall& c){
+    return file_delete(c.conn.session, c.req.args[0].c_str());
+}
+
+static void write_metadata_json(std::string& out, const FileMetadata& meta){
+    JsonWriter w(out);
+    w.begin_object();
+    w.field("path", meta.path);
+    w.field("name", meta.entry.name);
+    w.field("type", (meta.entry.type == static_cast<uint8_t>(EntryType::DIRECTORY)) ? "directory" : "file");
+    w.field("size", meta.entry.size);
+    w.field("owner", meta.entry.owner);
+    w.field("permissions", meta.entry.permissions);
+    w.field("created", meta.entry.created_time);
+    w.field("modified", meta.entry.modified_time);
+    w.field("blocks_used", meta.blocks_used);
+    w.field("inode", meta.entry.inode);
+    if(meta.entry.type != static_cast<uint8_t>(EntryType::DIRECTORY)) w.field("etag", etag_encode(meta.entry.inode, meta.entry.version));
+    w.end_object();
+}
+
+int OFSServer::opGetMetadata(OFSCall& c){
+    uint32_t inode;
+    uint64_t generation;
+    if(cachedReply(c, inode, generation)) return static_cast<int>(OFSErrorCodes::SUCCESS);
+    FileMetadata meta;
+    int r = get_metadata(c.conn.session, c.req.args[0].c_str(), &meta);
+    if(r==0){
+        write_metadata_json(c.data_json, meta);
+        if(inode) response_cache.store(c.req.opcode, inode, generation, c.req.args[0], c.data_json);
+    }
+    return r;
+}
+
+int OFSServer::opSetPermissions(OFSCall& c){
+    try {
+        uint32_t perms = static_cast<uint32_t>(std::stoul(c.req.args[1]));
+        return set_permissions(c.conn.session, c.req.args[0].c_str(), perms);
+    } catch(...) {
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
     }
-    else if(op=="read_file" && req.args.size()>=1){
-        char* buf=nullptr; size_t sz=0;
-        r = file_read(session,req.args[0].c_str(),&buf,&sz);
-        if(r==0 && buf){
-            data.assign(buf,sz);
-            free_buffer(buf);
+}
+
+// "batch" is followed by operations written as their own commands would be, e.g.
+// batch create_dir /d create_file /d/a "text" set_permissions /d/a 420
+int OFSServer::opBatch(OFSCall& c){
+    struct BatchSyntax { OFSOpcode op; OFSBatchOpType type; size_t args; };
+    static const BatchSyntax SYNTAX[] = {
+        {OFSOpcode::CREATE_FILE, OFSBatchOpType::CREATE_FILE, 2},
+        {OFSOpcode::DELETE_FILE, OFSBatchOpType::DELETE_FILE, 1},
+        {OFSOpcode::RENAME_FILE, OFSBatchOpType::RENAME, 2},
+        {OFSOpcode::CREATE_DIR, OFSBatchOpType::CREATE_DIR, 1},
+        {OFSOpcode::DELETE_DIR, OFSBatchOpType::DELETE_DIR, 1},
+        {OFSOpcode::SET_PERMISSIONS, OFSBatchOpType::SET_PERMISSIONS, 2},
+    };
+    const std::vector<std::string>& a = c.req.args;
+    std::vector<OFSBatchOp> ops;
+    std::vector<OFSOpcode> names;
+    for(size_t i = 0; i < a.size();){
+        OFSOpcode op = lookup_opcode(a[i]);
+        const BatchSyntax* syn = nullptr;
+        for(const BatchSyntax& b : SYNTAX) if(b.op == op) syn = &b;
+        if(!syn || i + syn->args >= a.size()){
+            c.msg = "batch: unknown operation or missing arguments at '" + a[i] + "'";
+            return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
         }
-        msg = get_error_message(r);
-    }
-    
-    else if (op == "edit_file" && req.args.size() >= 3) {
-        try {
-            unsigned int idx = std::stoul(req.args[2]);         
-            const std::string& new_data = req.args[1];         
-            r = file_edit(session, req.args[0].c_str(),        
-                          new_data.c_str(),                     
-                          new_data.size(),                      
-                          idx);                                
-        } catch (const std::exception& e) {
-            r = static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION); 
+        OFSBatchOp b{};
+        b.type = syn->type;
+        b.path = a[i + 1].c_str();
+        if(syn->type == OFSBatchOpType::SET_PERMISSIONS){
+            char* end = nullptr;
+            b.permissions = static_cast<uint32_t>(std::strtoul(a[i + 2].c_str(), &end, 10));
+            if(*end != '\0'){
+                c.msg = "batch: bad permissions '" + a[i + 2] + "'";
+                return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+            }
+        } else if(syn->args == 2){
+            b.arg = a[i + 2].c_str();
+            b.size = a[i + 2].size();
         }
-        msg = get_error_message(r);
-    }
-    else if (op == "truncate_file" && req.args.size() >= 2) {
-        unsigned long sz = 0;
-        try {
-            sz = std::stoul(req.args[1]);
-            r = file_truncate(session, req.args[0].c_str(), sz);
-        } catch (...) {
-            r = static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+        ops.push_back(b);
+        names.push_back(op);
+        i += 1 + syn->args;
+    }
+    int r = fs_batch(c.conn.session, ops.data(), static_cast<int>(ops.size()));
+    if(r == 0){
+        JsonWriter w(c.data_json);
+        w.begin_array();
+        for(size_t i = 0; i < ops.size(); i++){
+            w.begin_object();
+            w.field("op", opcode_name(names[i]));
+            w.field("path", ops[i].path);
+            w.field("status", ops[i].result == 0 ? "success" : "error");
+            w.field("error_message", get_error_message(ops[i].result));
+            w.end_object();
         }
-        msg = get_error_message(r);
-    }
-    else if(op=="rename_file" && req.args.size() >= 2) {
-        const std::string& old_path = req.args[0];
-        const std::string& new_path = req.args[1];
-        r = file_rename(session, old_path.c_str(), new_path.c_str());
-        msg = get_error_message(r);
-        if(r != 0) {
-            std::cerr << "[OFS] rename_file failed: " << old_path << " -> " << new_path
-                      << " code=" << r << " msg=" << msg << "\n";
+        w.end_array();
+    }
+    return r;
+}
+
+// Handles: file_open <path> returns a small number naming the open file on this
+// connection; handle_read <h> <offset> <length>, handle_write <h> <offset> <data>,
+// handle_stat <h> and file_close <h> then skip path resolution.
+static void* find_handle(OFSCall& c, const std::string& arg){
+    uint64_t h;
+    if(!parse_u64(arg, h) || h >= c.conn.handles.size() || !c.conn.handles[h]){
+        c.msg = "Unknown handle";
+        return nullptr;
+    }
+    return c.conn.handles[h];
+}
+
+int OFSServer::opFileOpen(OFSCall& c){
+    void* session = c.conn.session;
+    if(!session) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_SESSION);
+    std::vector<void*>& hs = c.conn.handles;
+    size_t slot = std::find(hs.begin(), hs.end(), nullptr) - hs.begin();
+    if(slot == hs.size() && hs.size() >= MAX_OPEN_HANDLES){
+        c.msg = "Too many open handles on this connection";
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    }
+    void* handle = nullptr;
+    int r = file_open(session, c.req.args[0].c_str(), &handle);
+    if(r != 0) return r;
+    FileMetadata meta;
+    handle_stat(handle, &meta);
+    if(slot == hs.size()) hs.push_back(handle);
+    else hs[slot] = handle;
+    JsonWriter w(c.data_json);
+    w.begin_object();
+    w.field("handle", static_cast<uint64_t>(slot));
+    w.field("inode", meta.entry.inode);
+    w.field("size", meta.entry.size);
+    w.end_object();
+    return r;
+}
+
+int OFSServer::opHandleRead(OFSCall& c){
+    void* h = find_handle(c, c.req.args[0]);
+    if(!h) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    uint64_t off, len;
+    if(!parse_u64(c.req.args[1], off) || !parse_u64(c.req.args[2], len) || len > MAX_HANDLE_READ)
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    char* buf = static_cast<char*>(std::malloc(len ? len : 1));
+    if(!buf) return static_cast<int>(OFSErrorCodes::ERROR_NO_SPACE);
+    size_t got = 0;
+    int r = handle_read(h, off, len, buf, &got);
+    if(r != 0){ std::free(buf); return r; }
+    c.blob = buf;
+    c.blob_len = got;
+    return r;
+}
+
+int OFSServer::opHandleWrite(OFSCall& c){
+    void* h = find_handle(c, c.req.args[0]);
+    if(!h) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    uint64_t off;
+    if(!parse_u64(c.req.args[1], off)) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    const std::string& data = c.req.args[2];
+    return handle_write(h, off, data.data(), data.size());
+}
+
+int OFSServer::opHandleStat(OFSCall& c){
+    void* h = find_handle(c, c.req.args[0]);
+    if(!h) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    FileMetadata meta;
+    int r = handle_stat(h, &meta);
+    if(r == 0) write_metadata_json(c.data_json, meta);
+    return r;
+}
+
+int OFSServer::opFileClose(OFSCall& c){
+    void* h = find_handle(c, c.req.args[0]);
+    if(!h) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    c.conn.handles[std::strtoull(c.req.args[0].c_str(), nullptr, 10)] = nullptr;
+    return file_close(h);
+}
+
+// Watches: watch <path> [subtree] returns a number, and changes then arrive on the
+// connection as unsolicited lines {"status":"event","operation":"watch","request_id":"",
+// "data":{"watch","event","path","type","inode"[,"old_path"]}} until unwatch <n>.
+static const char* const WATCH_EVENT_NAMES[] = {"create", "delete", "rename", "modify"};
+
+// Queues an event line, or holds it while a download streams. A client with more than
+// OUT_HIGH_WATER bytes unread loses events and gets one "overflow" event before the next.
+static void deliver_event(ClientConnection& conn, const std::string& line){
+    std::lock_guard<std::mutex> lock(conn.event_mtx);
+    size_t backlog = conn.streaming ? conn.held_events.size() : net_queued_bytes(conn);
+    if(backlog >= OUT_HIGH_WATER){ conn.events_dropped = true; return; }
+    std::string out;
+    if(conn.events_dropped){
+        JsonWriter w(out);
+        w.begin_object();
+        w.field("status", "event");
+        w.field("operation", "watch");
+        w.field("request_id", "");
+        w.key("data").begin_object().field("event", "overflow").end_object();
+        w.end_object();
+        out.push_back('\n');
+        conn.events_dropped = false;
+    }
+    out += line;
+    if(conn.streaming) conn.held_events += out;
+    else net_send(conn, out.data(), out.size());
+}
+
+// Brackets a streamed reply; events that arrive meanwhile are sent right after it.
+static void set_streaming(ClientConnection& conn, bool on){
+    std::lock_guard<std::mutex> lock(conn.event_mtx);
+    conn.streaming = on;
+    if(!on && !conn.held_events.empty()){
+        net_send(conn, conn.held_events.data(), conn.held_events.size());
+        conn.held_events.clear();
+    }
+}
+
+// Core watch callback; runs under the core lock on the thread that made the change. A
+// lease turns the first change into its invalidation and ignores the rest; an expired
+// lease is silent.
+static void watch_event(const OFSWatchEvent* ev, void* ctx){
+    ClientWatch* cw = static_cast<ClientWatch*>(ctx);
+    if(cw->lease && (cw->invalidated.exchange(true) || metrics_now_ns() >= cw->expires_ns)) return;
+    std::string line;
+    JsonWriter w(line);
+    w.begin_object();
+    w.field("status", "event");
+    w.field("operation", cw->lease ? "lease" : "watch");
+    w.field("request_id", "");
+    w.key("data").begin_object();
+    w.field(cw->lease ? "lease" : "watch", static_cast<uint64_t>(cw->number));
+    w.field("event", WATCH_EVENT_NAMES[static_cast<uint32_t>(ev->type)]);
+    w.field("path", ev->path);
+    w.field("type", (ev->entry_type == static_cast<uint8_t>(EntryType::DIRECTORY)) ? "directory" : "file");
+    w.field("inode", ev->inode);
+    if(ev->old_path) w.field("old_path", ev->old_path);
+    w.end_object();
+    w.end_object();
+    line.push_back('\n');
+    deliver_event(*cw->conn, line);
+}
+
+int OFSServer::opWatch(OFSCall& c){
+    void* session = c.conn.session;
+    if(!session) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_SESSION);
+    bool subtree = c.req.args.size() > 1 && c.req.args[1] == "subtree";
+    std::vector<std::unique_ptr<ClientWatch>>& ws = c.conn.watches;
+    size_t slot = std::find(ws.begin(), ws.end(), nullptr) - ws.begin();
+    if(slot == ws.size() && ws.size() >= MAX_WATCHES){
+        c.msg = "Too many watches on this connection";
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    }
+    std::unique_ptr<ClientWatch> cw(new ClientWatch{&c.conn, slot, nullptr});
+    int r = fs_watch_add(session, c.req.args[0].c_str(), subtree ? 1 : 0, watch_event, cw.get(), &cw->watch);
+    if(r != 0) return r;
+    if(slot == ws.size()) ws.push_back(nullptr);
+    ws[slot] = std::move(cw);
+    JsonWriter w(c.data_json);
+    w.begin_object();
+    w.field("watch", static_cast<uint64_t>(slot));
+    w.end_object();
+    return r;
+}
+
+int OFSServer::opUnwatch(OFSCall& c){
+    uint64_t n;
+    if(!parse_u64(c.req.args[0], n) || n >= c.conn.watches.size() || !c.conn.watches[n]){
+        c.msg = "Unknown watch";
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    }
+    int r = fs_watch_remove(c.conn.watches[n]->watch);
+    c.conn.watches[n].reset();
+    return r;
+}
+
+// Read leases: lease <path> [seconds] [read] returns the entry's metadata and version,
+// and with read also a file's content. Until the lease expires the server sends
+// {"status":"event","operation":"lease","request_id":"","data":{"lease","event",...}} on
+// the first change to the entry (or, for a directory, to its children), after which the
+// lease is spent. Versions are generations, so they only compare within one server run.
+static void prune_leases(ClientConnection& conn){
+    uint64_t now = metrics_now_ns();
+    for(auto& l : conn.leases){
+        if(l && (l->invalidated || now >= l->expires_ns)){
+            fs_watch_remove(l->watch);
+            l.reset();
         }
     }
-    else if (op == "delete_file" && req.args.size() >= 1) {
-        r = file_delete(session, req.args[0].c_str());
-        msg = get_error_message(r);
-    }
-
-    else if(op == "get_metadata" && req.args.size() >= 1) {
-        FileMetadata meta;
-        r = get_metadata(session, req.args[0].c_str(), &meta);
-        if(r==0){
-            std::ostringstream oss;
-            oss << "Path: " << meta.path << "\n";
-            oss << "Name: " << meta.entry.name << "\n";
-            oss << "Type: " << (meta.entry.type == static_cast<uint8_t>(EntryType::DIRECTORY) ? "directory" : "file") << "\n";
-            oss << "Size: " << meta.entry.size << " bytes\n";
-            oss << "Owner: " << meta.entry.owner << "\n";
-            oss << "Permissions: " << meta.entry.permissions << "\n";
-            oss << "Created: " << fmt_time(meta.entry.created_time) << "\n";
-            oss << "Modified: " << fmt_time(meta.entry.modified_time) << "\n";
-            oss << "Blocks used: " << meta.blocks_used << "\n";
-            data = oss.str();
+}
+
+int OFSServer::opLease(OFSCall& c){
+    void* session = c.conn.session;
+    if(!session) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_SESSION);
+    const char* path = c.req.args[0].c_str();
+    uint64_t seconds = LEASE_DEFAULT_SECONDS;
+    bool read = false;
+    for(size_t i = 1; i < c.req.args.size(); i++){
+        if(c.req.args[i] == "read") read = true;
+        else if(!parse_u64(c.req.args[i], seconds) || seconds == 0 || seconds > LEASE_MAX_SECONDS){
+            c.msg = "Bad lease argument: " + c.req.args[i];
+            return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
         }
-        msg = get_error_message(r);
-    }
-    else if(op == "set_permissions" && req.args.size() >= 2) {
-        uint32_t perms = 0;
-        try {
-            perms = static_cast<uint32_t>(std::stoul(req.args[1]));
-            r = set_permissions(session, req.args[0].c_str(), perms);
-        } catch(...) {
-            r = static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    }
+    std::vector<std::unique_ptr<ClientWatch>>& ls = c.conn.leases;
+    size_t slot = std::find(ls.begin(), ls.end(), nullptr) - ls.begin();
+    if(slot == ls.size() && ls.size() >= MAX_LEASES){
+        prune_leases(c.conn);
+        slot = std::find(ls.begin(), ls.end(), nullptr) - ls.begin();
+        if(slot == ls.size()){
+            c.msg = "Too many leases on this connection";
+            return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
         }
-        msg = get_error_message(r);
     }
-    else if(op == "set_owner") {
-        r = static_cast<int>(OFSErrorCodes::ERROR_NOT_IMPLEMENTED);
-        msg = get_error_message(r);
+    // The watch goes in first, so any change after the version below is read invalidates the lease.
+    std::unique_ptr<ClientWatch> cw(new ClientWatch{&c.conn, slot, nullptr});
+    cw->lease = true;
+    cw->expires_ns = metrics_now_ns() + seconds * 1000000000ull;
+    int r = fs_watch_add(session, path, 0, watch_event, cw.get(), &cw->watch);
+    if(r != 0) return r;
+    uint32_t inode = 0;
+    uint64_t version = 0;
+    FileMetadata meta;
+    char* buf = nullptr;
+    size_t sz = 0;
+    r = get_generation(session, path, &inode, &version);
+    if(r == 0) r = get_metadata(session, path, &meta);
+    if(r == 0 && read) r = file_read(session, path, &buf, &sz);
+    if(r != 0){
+        fs_watch_remove(cw->watch);
+        return r;
     }
-    else if(op == "get_session_info") {
-        if(!session){
-            r = static_cast<int>(OFSErrorCodes::ERROR_INVALID_SESSION);
-            msg = get_error_message(r);
-        } else {
-            SessionInfo info;
-            r = get_session_info(session, &info);
-            if(r==0){
-                std::ostringstream oss;
-                oss << "Session ID: " << info.session_id << "\n";
-                oss << "User: " << info.user.username << "\n";
-                oss << "Role: " << ((info.user.role==UserRole::ADMIN)?"admin":"normal") << "\n";
-                oss << "Login time: " << fmt_time(info.login_time) << "\n";
-                oss << "Last activity: " << fmt_time(info.last_activity) << "\n";
-                oss << "Operations: " << info.operations_count << "\n";
-                data = oss.str();
+    std::string meta_json;
+    write_metadata_json(meta_json, meta);
+    JsonWriter w(c.data_json);
+    w.begin_object();
+    w.field("lease", static_cast<uint64_t>(slot));
+    w.field("version", version);
+    w.field("expires_in", seconds);
+    w.key("metadata").raw(meta_json);
+    if(read) w.key("content").value(buf ? buf : "", sz);
+    w.end_object();
+    free_buffer(buf);
+    if(slot == ls.size()) ls.push_back(nullptr);
+    ls[slot] = std::move(cw);
+    return r;
+}
+
+// unlease <n>: gives a lease back early.
+int OFSServer::opUnlease(OFSCall& c){
+    uint64_t n;
+    if(!parse_u64(c.req.args[0], n) || n >= c.conn.leases.size() || !c.conn.leases[n]){
+        c.msg = "Unknown lease";
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    }
+    int r = fs_watch_remove(c.conn.leases[n]->watch);
+    c.conn.leases[n].reset();
+    return r;
+}
+
+int OFSServer::opSetOwner(OFSCall& c){
+    return set_owner(c.conn.session, c.req.args[0].c_str(), c.req.args[1].c_str());
+}
+
+int OFSServer::opGetSessionInfo(OFSCall& c){
+    void* session = c.conn.session;
+    if(!session) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_SESSION);
+    SessionInfo info;
+    int r = get_session_info(session, &info);
+    if(r==0){
+        JsonWriter w(c.data_json);
+        w.begin_object();
+        w.field("session_id", info.session_id);
+        w.field("user", info.user.username);
+        w.field("role", (info.user.role==UserRole::ADMIN) ? "admin" : "normal");
+        w.field("login_time", info.login_time);
+        w.field("last_activity", info.last_activity);
+        w.field("operations", info.operations_count);
+        w.end_object();
+    }
+    return r;
+}
+
+// Replies with a JSON header carrying the file size, followed by exactly that many raw
+// bytes. The file is opened and mapped once, then sent in bounded windows, waiting for the
+// client to drain each one. On volumes that store bytes unencoded each window's block
+// payloads are handed to sendfile() straight from the container; the open handle keeps
+// those blocks from being reused until the last range has gone out. Otherwise each window
+// is read and decoded under the core lock. Either way a window fails, and the connection
+// is closed, once the file has changed since the map was made.
+// Download in progress: the open file, its map and the next extent to send.
+struct DownloadStream : HandlerState {
+    std::shared_ptr<void> handle;   // shared with the queued file ranges
+    OFSExtent* extents = nullptr;
+    int count = 0;
+    int next = 0;
+    int raw_fd = -1;
+    std::vector<char> chunk;
+    ~DownloadStream() override { free_buffer(extents); }
+};
+
+int OFSServer::opDownload(OFSCall& c){
+    static const size_t CHUNK_BYTES = 256u << 10;
+    static const std::vector<char> zeros(64u << 10, 0);
+    std::shared_ptr<DownloadStream> st = std::static_pointer_cast<DownloadStream>(c.req.resume);
+    if(!st){
+        void* session = c.conn.session;
+        if(!session) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_SESSION);
+        st = std::make_shared<DownloadStream>();
+        void* handle = nullptr;
+        int r = file_open(session, c.req.args[0].c_str(), &handle);
+        if(r != 0) return r;
+        st->handle.reset(handle, [](void* h){ file_close(h); });
+        size_t size = 0;
+        r = handle_map_extents(handle, &st->extents, &st->count, &size, &st->raw_fd);
+        if(r != 0) return r;
+
+        c.responded = true;
+        c.msg = get_error_message(r);
+        set_streaming(c.conn, true);
+        JsonWriter w(c.data_json);
+        w.begin_object();
+        w.field("size", static_cast<uint64_t>(size));
+        w.field("transfer", st->raw_fd >= 0 ? "sendfile" : "chunked");
+        w.end_object();
+        std::string& out = json_thread_buffer(0);
+        write_response_json(out, true, c.req, c);
+        sendResponse(c.conn, out);
+    }
+    c.responded = true;
+
+    // Queue one window per step; suspend while the client is behind.
+    while(st->next < st->count){
+        int first = st->next;
+        size_t bytes = 0;
+        while(st->next < st->count && (bytes == 0 || bytes + st->extents[st->next].length <= CHUNK_BYTES))
+            bytes += st->extents[st->next++].length;
+        bool ok;
+        int r;
+        if(st->raw_fd >= 0){
+            // File ranges are queued without copying; the event loop sends them as the client
+            // reads. Holes (offset 0) have no range in the container and go out as zeros.
+            r = handle_check_extents(st->handle.get());
+            ok = r == 0;
+            for(int i = first; i < st->next && ok; ++i){
+                if(st->extents[i].offset){
+                    ok = net_send_file(c.conn, st->raw_fd, st->extents[i].offset, st->extents[i].length, st->handle);
+                    continue;
+                }
+                for(uint64_t left = st->extents[i].length, n; ok && left; left -= n){
+                    n = std::min<uint64_t>(left, zeros.size());
+                    ok = net_send(c.conn, zeros.data(), n);
+                }
             }
-            msg = get_error_message(r);
+        } else {
+            st->chunk.resize(bytes);
+            r = handle_read_extents(st->handle.get(), first, st->next - first, st->chunk.data());
+            ok = r == 0 && net_send(c.conn, st->chunk.data(), bytes);
         }
+        if(!ok){
+            // The header already promised `size` bytes; a short stream must not look complete.
+            if(r != 0)
+                log_event(LogLevel::WARN, LogFields{c.conn.fd, c.conn.user.c_str(), OFSOpcode::DOWNLOAD},
+                          "download aborted: %s: %s", c.req.args[0].c_str(), get_error_message(r));
+            net_abort(c.conn);
+            set_streaming(c.conn, false);
+            return 0;
+        }
+        if(st->next < st->count){ c.suspend = st; return 0; }
+    }
+    set_streaming(c.conn, false);
+    return 0;
+}
+
+// Streaming upload: upload_begin <path>, any number of upload_chunk <n> (each followed by
+// n raw bytes), then upload_commit. Blocks are written as chunks arrive, so the server
+// holds at most one block plus the queued chunks for a connection.
+int OFSServer::opUploadBegin(OFSCall& c){
+    void* session = c.conn.session;
+    if(!session) return static_cast<int>(OFSErrorCodes::ERROR_INVALID_SESSION);
+    if(c.conn.upload){
+        c.msg = "An upload is already in progress on this connection";
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    }
+    void* upload = nullptr;
+    int r = file_upload_begin(session, c.req.args[0].c_str(), &upload);
+    if(r==0) c.conn.upload = upload;
+    return r;
+}
+
+int OFSServer::opUploadChunk(OFSCall& c){
+    if(!c.conn.upload){
+        c.msg = "No upload in progress";
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
     }
+    return file_upload_write(c.conn.upload, c.req.body.data(), c.req.body.size());
+}
 
-    else {
-        r = static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
-        msg = "Unknown command or wrong arguments";
+int OFSServer::opUploadCommit(OFSCall& c){
+    void* upload = c.conn.upload;
+    if(!upload){
+        c.msg = "No upload in progress";
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
     }
+    c.conn.upload = nullptr;
+    return file_upload_commit(upload);
+}
+
+int OFSServer::opUploadAbort(OFSCall& c){
+    void* upload = c.conn.upload;
+    if(!upload){
+        c.msg = "No upload in progress";
+        return static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION);
+    }
+    c.conn.upload = nullptr;
+    return file_upload_abort(upload);
+}
 
-    resp.json = make_response_json((r == 0) ? "success" : "error", op, msg, data);
-    sendResponse(resp);
+// Counters and latency summaries in Prometheus text format, carried in "data".
+int OFSServer::opMetrics(OFSCall& c){
+    metrics_render(c.data);
+    return static_cast<int>(OFSErrorCodes::SUCCESS);
 }
 
-void OFSServer::sendResponse(const OFSResponse& resp){
-    std::string s = resp.json + "\n";
-    send(resp.client_fd,s.c_str(),s.size(),0);
+void OFSServer::sendResponse(ClientConnection& conn, const std::string& json){
+    net_send(conn, json.data(), json.size());
 }
 
@@ -5,67 +5,145 @@
 #include <thread>
 #include <mutex>
 #include <unordered_map>
-#include <queue>
 #include <condition_variable>
+#include <memory>
 #include "../include/ofs_types.hpp"
+#include "server_network.hpp"
+#include "request.hpp"
+#include "response_cache.hpp"
+#include "scheduler.hpp"
 
-struct OFSRequest {
-    std::string cmd;
-    std::vector<std::string> args;
-    int client_fd;
+// State handed to an opcode handler: the request, the connection it came from,
+// and the reply payload/message the handler fills in. A handler sets at most one of
+// data (text, escaped on output), data_json (an already-serialized JSON value) or
+// blob (a core buffer, escaped on output and released with free_buffer).
+// Handlers that write their own reply (streaming transfers) set responded. A handler
+// that has more to send than the client has read sets suspend and returns; it runs again,
+// with suspend in req.resume, once the connection's output queue drains.
+struct OFSCall {
+    const OFSRequest& req;
+    ClientConnection& conn;
+    std::string data;
+    std::string& data_json;
+    char* blob;
+    size_t blob_len;
+    std::string msg;
+    std::string etag;     // version tag of the content returned, sent as the reply's "etag"
+    bool responded;
+    std::shared_ptr<HandlerState> suspend;
+    OFSCall(const OFSRequest& r, ClientConnection& c, std::string& json_scratch)
+        : req(r), conn(c), data_json(json_scratch), blob(nullptr), blob_len(0), responded(false) {}
 };
+// Worker lanes. Each has its own scheduler and threads, so cheap lookups never wait
+// behind queued transfers of file contents.
+enum class OpLane : uint8_t { METADATA = 0, BULK, COUNT };
 
-struct OFSResponse {
-    int client_fd;
-    std::string json;
+// One event loop: an epoll instance, its listening sockets and the connections it accepted.
+// Each reactor runs on its own thread and never touches another reactor's connections.
+struct Reactor {
+    int epoll_fd = -1;
+    int tcp_fd = -1;
+    int unix_fd = -1;
+    std::thread thread;
+    std::unordered_map<int, std::shared_ptr<ClientConnection>> connections;
+    uint64_t sent_sweep_ns = 0;   // last net_release_sent pass over connections
 };
-template<typename T>
-class TSQueue {
-private:
-    std::queue<T> q;
-    std::mutex mtx;
-    std::condition_variable cv;
-public:
-    void push(const T& item) {
-        std::unique_lock<std::mutex> lock(mtx);
-        q.push(item);
-        cv.notify_one();
-    }
 
-    bool pop(T& item) {
-        std::unique_lock<std::mutex> lock(mtx);
-        if(q.empty()) {
-            cv.wait(lock, [this]{ return !q.empty(); });
-        }
-        if(q.empty()) return false;
-        item = q.front();
-        q.pop();
-        return true;
-    }
+// The core instance lock as a Lockable, so the inline path can hold it with std::unique_lock.
+struct CoreLock {
+    void* fs;
+    bool try_lock();
+    void unlock();
 };
+
 class OFSServer {
 private:
-    int server_fd;
+    std::vector<std::unique_ptr<Reactor>> reactors;
+    std::string unix_path;
     bool running;
-    std::thread accept_thread;
+    bool inline_dispatch;     // run metadata requests on the reactor instead of the worker pool
     std::vector<std::thread> worker_threads;
-    TSQueue<OFSRequest> op_queue;
-    std::unordered_map<int, void*> client_sessions;
-    std::mutex session_mtx;
+    RequestScheduler lanes[static_cast<size_t>(OpLane::COUNT)];
+    RateLimiter rate_limiter;
+    SchedulerConfig sched_cfg;
+    ResponseCache response_cache;
     void* fs_inst;
 uint32_t max_connections;  
 uint32_t queue_timeout;  
 
-    void acceptLoop();
-    void workerLoop();
-    void handleRequest(const OFSRequest& req);
+    int listenTcp(uint16_t port, bool reuse_port);
+    int listenUnix(const std::string& path);
+    bool watchListener(Reactor& r, int fd);
+    void reactorLoop(Reactor* r);
+    void acceptClients(Reactor& r, int listen_fd);
+    void readClient(Reactor& r, const std::shared_ptr<ClientConnection>& conn);
+    void closeClient(Reactor& r, int fd);
+    void submitRequest(OFSRequest&& req);
+    void enqueueRequest(OFSRequest& req);
+    bool mayRunInline(const OFSRequest& req, std::unique_lock<CoreLock>& core_lock);
+    void completeRequest(const OFSRequest& done);
+    void workerLoop(RequestScheduler* lane);
+    // Returns false if the request suspended; it was then moved into the connection and
+    // completeRequest runs when its last step finishes.
+    bool handleRequest(OFSRequest& req);
+
+    struct OpHandlerEntry {
+        int (OFSServer::*fn)(OFSCall&);
+        size_t min_args;
+        OpLane lane;          // BULK handlers may wait on the client and always run on a worker
+    };
+    static const OpHandlerEntry OP_HANDLERS[];
+
+    int opLogin(OFSCall& c);
+    int opLogout(OFSCall& c);
+    int opCreateUser(OFSCall& c);
+    int opDeleteUser(OFSCall& c);
+    int opListUsers(OFSCall& c);
+    int opCreateDir(OFSCall& c);
+    int opDeleteDir(OFSCall& c);
+    int opDirExists(OFSCall& c);
+    int opDirList(OFSCall& c);
+    int opCreateFile(OFSCall& c);
+    int opReadFile(OFSCall& c);
+    int opEditFile(OFSCall& c);
+    int opTruncateFile(OFSCall& c);
+    int opRenameFile(OFSCall& c);
+    int opDeleteFile(OFSCall& c);
+    int opGetMetadata(OFSCall& c);
+    int opSetPermissions(OFSCall& c);
+    int opSetOwner(OFSCall& c);
+    int opGetSessionInfo(OFSCall& c);
+    int opDownload(OFSCall& c);
+    int opUploadBegin(OFSCall& c);
+    int opUploadChunk(OFSCall& c);
+    int opUploadCommit(OFSCall& c);
+    int opUploadAbort(OFSCall& c);
+    int opMetrics(OFSCall& c);
+    int opBatch(OFSCall& c);
+    int opFileOpen(OFSCall& c);
+    int opHandleRead(OFSCall& c);
+    int opHandleWrite(OFSCall& c);
+    int opHandleStat(OFSCall& c);
+    int opFileClose(OFSCall& c);
+    int opPrefixList(OFSCall& c);
+    int opFind(OFSCall& c);
+    int opDeleteTree(OFSCall& c);
+    int opCopyTree(OFSCall& c);
+    int opWatch(OFSCall& c);
+    int opUnwatch(OFSCall& c);
+    int opLease(OFSCall& c);
+    int opUnlease(OFSCall& c);
+    int opReadIf(OFSCall& c);
     std::vector<std::string> parseArgs(const std::string& line);
-    std::string make_response_json(const std::string& status, const std::string& op, const std::string& error, const std::string& data);
+    bool cachedReply(OFSCall& c, uint32_t& inode, uint64_t& generation);
+    void write_response_json(std::string& out, bool ok, const OFSRequest& req, const OFSCall& call);
 public:
     OFSServer();
     ~OFSServer();
-      bool start(uint16_t port, void* _fs_inst, uint32_t max_conn, uint32_t queue_tmo);
+      bool start(uint16_t port, void* _fs_inst, uint32_t max_conn, uint32_t queue_tmo,
+                 const std::string& unix_socket = "", uint32_t reactor_threads = 1,
+                 const SchedulerConfig& sched = SchedulerConfig());
    
     void stop();
-    void sendResponse(const OFSResponse& resp);
+    void sendResponse(ClientConnection& conn, const std::string& json);
 };
@@ -1 +1,215 @@
+#include "server_network.hpp"
+#include "../core/ofs_core.hpp"
+#include "metrics.hpp"
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
 
+static const int MAX_IOV_PER_CALL = 64;
+
+ClientConnection::~ClientConnection() {
+    if (upload) file_upload_abort(upload);
+    for (void* h : handles) if (h) file_close(h);
+    for (auto& w : watches) if (w) fs_watch_remove(w->watch);
+    for (auto& l : leases) if (l) fs_watch_remove(l->watch);
+}
+
+bool net_set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0) return false;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+static void net_update_events(ClientConnection& c) {
+    epoll_event ev{};
+    ev.events = EPOLLRDHUP;
+    if (!c.read_paused && !c.input_paused) ev.events |= EPOLLIN;
+    if (c.want_write) ev.events |= EPOLLOUT;
+    ev.data.fd = c.fd;
+    epoll_ctl(c.epoll_fd, EPOLL_CTL_MOD, c.fd, &ev);
+}
+
+bool net_register(ClientConnection& c) {
+    epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.fd = c.fd;
+    return epoll_ctl(c.epoll_fd, EPOLL_CTL_ADD, c.fd, &ev) == 0;
+}
+
+void net_close(ClientConnection& c) {
+    // A parked request holds a reference to the connection; drop it after unlocking.
+    std::function<void()> parked;
+    std::lock_guard<std::mutex> lock(c.out_mtx);
+    if (c.closed) return;
+    c.closed = true;
+    epoll_ctl(c.epoll_fd, EPOLL_CTL_DEL, c.fd, nullptr);
+    if (!c.sent_owners.empty()) {
+        // Unacknowledged file ranges would keep going out after close(), from pages whose
+        // blocks are about to be released; reset the connection instead.
+        linger lg{1, 0};
+        setsockopt(c.fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+    }
+    close(c.fd);
+    c.out_queue.clear();
+    c.out_head = 0;
+    c.out_bytes = 0;
+    c.sent_owners.clear();
+    parked.swap(c.on_drained);
+}
+
+// Consumes n written bytes from the front of the queue.
+static void net_consume_locked(ClientConnection& c, size_t n) {
+    c.out_bytes -= n;
+    while (n > 0 && !c.out_queue.empty()) {
+        size_t avail = c.out_queue.front().size() - c.out_head;
+        if (n < avail) {
+            c.out_head += n;
+            c.out_written += n;
+            return;
+        }
+        n -= avail;
+        c.out_written += avail;
+        if (c.out_queue.front().owner) c.sent_owners.emplace_back(c.out_written, std::move(c.out_queue.front().owner));
+        c.out_queue.pop_front();
+        c.out_head = 0;
+    }
+}
+
+// Caller holds out_mtx.
+static void net_release_sent_locked(ClientConnection& c) {
+    if (c.sent_owners.empty()) return;
+    int unacked = 0;   // bytes in the socket's send queue that the peer has not acknowledged
+    if (ioctl(c.fd, SIOCOUTQ, &unacked) < 0) return;
+    uint64_t acked = c.out_written > uint64_t(unacked) ? c.out_written - unacked : 0;
+    while (!c.sent_owners.empty() && c.sent_owners.front().first <= acked) c.sent_owners.pop_front();
+}
+
+// Writes queued output until the queue is empty or the socket would block:
+// runs of in-memory chunks go out with one writev, file ranges with sendfile.
+// Returns false on a fatal socket error. Caller holds out_mtx.
+static bool net_flush_locked(ClientConnection& c) {
+    while (!c.out_queue.empty()) {
+        const OutChunk& front = c.out_queue.front();
+        ssize_t n;
+        if (front.is_file()) {
+            off_t off = static_cast<off_t>(front.file_off + c.out_head);
+            n = sendfile(c.fd, front.file_fd, &off, front.file_len - c.out_head);
+            if (n == 0) return false;   // file shorter than promised
+        } else {
+            iovec iov[MAX_IOV_PER_CALL];
+            int cnt = 0;
+            for (auto it = c.out_queue.begin(); it != c.out_queue.end() && cnt < MAX_IOV_PER_CALL && !it->is_file(); ++it, ++cnt) {
+                size_t skip = (cnt == 0) ? c.out_head : 0;
+                iov[cnt].iov_base = const_cast<char*>(it->data.data()) + skip;
+                iov[cnt].iov_len = it->data.size() - skip;
+            }
+            n = writev(c.fd, iov, cnt);
+        }
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return true;
+            return false;
+        }
+        metrics_add(metrics_local().bytes_out, static_cast<uint64_t>(n));
+        net_consume_locked(c, static_cast<size_t>(n));
+    }
+    net_release_sent_locked(c);
+    return true;
+}
+
+static bool net_after_flush_locked(ClientConnection& c, bool ok) {
+    if (!ok) {
+        // Let the event loop see the hangup and tear the connection down.
+        shutdown(c.fd, SHUT_RDWR);
+        return false;
+    }
+    bool want_write = !c.out_queue.empty();
+    bool read_paused = c.read_paused;
+    if (c.out_bytes >= OUT_HIGH_WATER) read_paused = true;
+    else if (c.out_bytes <= OUT_LOW_WATER) read_paused = false;
+    if (want_write != c.want_write || read_paused != c.read_paused) {
+        c.want_write = want_write;
+        c.read_paused = read_paused;
+        net_update_events(c);
+    }
+    return true;
+}
+
+bool net_enqueue(ClientConnection& c, std::string&& data) {
+    std::lock_guard<std::mutex> lock(c.out_mtx);
+    if (c.closed) return false;
+    if (data.empty()) return true;
+    c.out_bytes += data.size();
+    c.out_queue.emplace_back(std::move(data));
+    // If EPOLLOUT is already armed the socket is full; let the event loop drain it.
+    bool ok = c.want_write ? true : net_flush_locked(c);
+    return net_after_flush_locked(c, ok);
+}
+
+bool net_send(ClientConnection& c, const char* data, size_t len) {
+    std::lock_guard<std::mutex> lock(c.out_mtx);
+    if (c.closed) return false;
+    if (len == 0) return true;
+    if (!c.out_queue.empty() && !c.out_queue.back().is_file() &&
+        c.out_queue.back().data.size() + len <= OUT_COALESCE_LIMIT) {
+        c.out_queue.back().data.append(data, len);
+    } else {
+        c.out_queue.emplace_back(data, len);
+    }
+    c.out_bytes += len;
+    bool ok = c.want_write ? true : net_flush_locked(c);
+    return net_after_flush_locked(c, ok);
+}
+
+bool net_send_file(ClientConnection& c, int file_fd, uint64_t off, size_t len, std::shared_ptr<void> owner) {
+    std::lock_guard<std::mutex> lock(c.out_mtx);
+    if (c.closed) return false;
+    if (len == 0) return true;
+    c.out_queue.emplace_back(file_fd, off, len, std::move(owner));
+    c.out_bytes += len;
+    bool ok = c.want_write ? true : net_flush_locked(c);
+    return net_after_flush_locked(c, ok);
+}
+
+bool net_park_until_drained(ClientConnection& c, std::function<void()>&& resume) {
+    std::lock_guard<std::mutex> lock(c.out_mtx);
+    if (c.closed || c.out_bytes <= OUT_LOW_WATER) return false;
+    c.on_drained = std::move(resume);
+    return true;
+}
+
+void net_release_sent(ClientConnection& c) {
+    std::lock_guard<std::mutex> lock(c.out_mtx);
+    if (!c.closed) net_release_sent_locked(c);
+}
+
+size_t net_queued_bytes(ClientConnection& c) {
+    std::lock_guard<std::mutex> lock(c.out_mtx);
+    return c.out_bytes;
+}
+
+void net_abort(ClientConnection& c) {
+    std::lock_guard<std::mutex> lock(c.out_mtx);
+    if (!c.closed) shutdown(c.fd, SHUT_RDWR);
+}
+
+void net_set_input_paused(ClientConnection& c, bool paused) {
+    std::lock_guard<std::mutex> lock(c.out_mtx);
+    if (c.closed || c.input_paused == paused) return;
+    c.input_paused = paused;
+    net_update_events(c);
+}
+
+bool net_on_writable(ClientConnection& c, std::function<void()>& resume) {
+    std::lock_guard<std::mutex> lock(c.out_mtx);
+    if (c.closed) return false;
+    if (!net_after_flush_locked(c, net_flush_locked(c))) return false;
+    if (c.on_drained && c.out_bytes <= OUT_LOW_WATER) resume.swap(c.on_drained);
+    return true;
+}
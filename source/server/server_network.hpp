@@ -1 +1,147 @@
+#pragma once
+#include <string>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <memory>
+#include <functional>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include "request.hpp"
 
+// Pause reading from a client once this many response bytes are queued for it,
+// and resume once the queue drains below the low-water mark.
+static const size_t OUT_HIGH_WATER = 1u << 20;
+static const size_t OUT_LOW_WATER = 256u << 10;
+// Small responses are appended to the last queued buffer up to this size
+// so a burst of replies goes out in one writev.
+static const size_t OUT_COALESCE_LIMIT = 64u << 10;
+// Requests a client may have queued behind the one executing before reading pauses.
+static const size_t MAX_PIPELINE_DEPTH = 1024;
+// Upper bound on one request line still waiting for its '\n'.
+static const size_t MAX_REQUEST_LINE = 16u << 20;
+// Largest raw body a single upload_chunk may carry.
+static const size_t MAX_UPLOAD_CHUNK = 1u << 20;
+// Open file handles one connection may hold.
+static const size_t MAX_OPEN_HANDLES = 64;
+// Largest range a single handle_read may return.
+static const size_t MAX_HANDLE_READ = 4u << 20;
+// Watches one connection may hold.
+static const size_t MAX_WATCHES = 64;
+// Read leases one connection may hold, and how long one lasts by default and at most.
+static const size_t MAX_LEASES = 1024;
+static const uint64_t LEASE_DEFAULT_SECONDS = 30;
+static const uint64_t LEASE_MAX_SECONDS = 300;
+// Entries a page of find or a paged dir_list holds by default and at most.
+static const int PAGE_DEFAULT_LIMIT = 1000;
+static const int PAGE_MAX_LIMIT = 10000;
+// Reading pauses once this many body bytes are queued and not yet written to the volume.
+static const size_t MAX_QUEUED_BODY_BYTES = 4u << 20;
+// Bytes read from one socket per readiness event before yielding to other clients.
+static const size_t READ_BUDGET = 1u << 20;
+
+// One piece of queued output: bytes in memory, or a range of an open file
+// that is handed to sendfile() without passing through user space.
+struct OutChunk {
+    std::string data;
+    int file_fd;          // -1 for in-memory data
+    uint64_t file_off;
+    size_t file_len;
+    std::shared_ptr<void> owner;   // keeps the range valid until the chunk is sent or dropped
+
+    explicit OutChunk(std::string&& d) : data(std::move(d)), file_fd(-1), file_off(0), file_len(0) {}
+    OutChunk(const char* d, size_t n) : data(d, n), file_fd(-1), file_off(0), file_len(0) {}
+    OutChunk(int fd, uint64_t off, size_t len, std::shared_ptr<void>&& keep)
+        : file_fd(fd), file_off(off), file_len(len), owner(std::move(keep)) {}
+    bool is_file() const { return file_fd >= 0; }
+    size_t size() const { return is_file() ? file_len : data.size(); }
+};
+
+struct ClientConnection;
+// A watch from the watch command, or the watch behind a read lease: the core watch and
+// where its events go.
+struct ClientWatch {
+    ClientConnection* conn;
+    size_t number;     // what the client calls it; the index in ClientConnection::watches or leases
+    void* watch;       // core watch from fs_watch_add
+    bool lease = false;
+    uint64_t expires_ns = 0;                // leases: end of the lease (metrics_now_ns clock)
+    std::atomic<bool> invalidated{false};   // leases: the one invalidation has been sent
+};
+
+struct ClientConnection {
+    int fd;
+    int epoll_fd;
+    std::string in_buf;
+    std::atomic<void*> session;   // core session after a successful login on this connection
+    void* upload;                 // core upload handle between upload_begin and upload_commit/abort
+    std::vector<void*> handles;   // core file handles from file_open; the index is the number the client uses
+    std::vector<std::unique_ptr<ClientWatch>> watches;   // from watch; null slots are free
+    std::vector<std::unique_ptr<ClientWatch>> leases;    // from lease; null slots are free
+    std::string user;             // login name, for log records and the scheduler flow; only touched by this connection's requests
+    bool admin;                   // the logged-in user has the admin role
+
+    // Requests from one connection run one at a time, in the order they were sent;
+    // the rest wait here while one is in flight.
+    std::mutex req_mtx;
+    std::deque<OFSRequest> pending;
+    bool in_flight;
+    size_t queued_body_bytes;     // request bodies received but not yet handled
+
+    std::mutex out_mtx;
+    std::deque<OutChunk> out_queue;
+    size_t out_head;      // bytes of out_queue.front() already written
+    size_t out_bytes;     // bytes queued and not yet written
+    uint64_t out_written; // bytes handed to the socket so far
+    // Owners of file ranges already passed to sendfile(), with the out_written offset at
+    // which each range ends. The socket refers to the file's pages rather than a copy until
+    // the peer has acknowledged them, so the owner is only released after that.
+    std::deque<std::pair<uint64_t, std::shared_ptr<void>>> sent_owners;
+    bool want_write;      // EPOLLOUT currently armed
+    bool read_paused;     // EPOLLIN removed because out_bytes crossed OUT_HIGH_WATER
+    bool input_paused;    // EPOLLIN removed because too many requests are pending
+    bool closed;
+    std::function<void()> on_drained;   // suspended request, resumed once out_bytes <= OUT_LOW_WATER
+
+    // Watch events arrive on whichever thread made the change. While a streamed reply
+    // (download) is being queued they wait in held_events, so they never land inside it.
+    std::mutex event_mtx;
+    bool streaming;
+    std::string held_events;
+    bool events_dropped;   // events were discarded because the client fell behind
+
+    ClientConnection(int _fd, int _epoll_fd)
+        : fd(_fd), epoll_fd(_epoll_fd), session(nullptr), upload(nullptr), admin(false), in_flight(false), queued_body_bytes(0),
+          out_head(0), out_bytes(0), out_written(0), want_write(false), read_paused(false), input_paused(false),
+          closed(false), streaming(false), events_dropped(false) {}
+    // Releases the blocks of an upload the client never committed and closes open handles
+    // and watches.
+    ~ClientConnection();
+};
+
+bool net_set_nonblocking(int fd);
+bool net_register(ClientConnection& c);
+void net_close(ClientConnection& c);
+// Queues data behind anything already pending and writes as much as the socket takes.
+bool net_enqueue(ClientConnection& c, std::string&& data);
+// Same as net_enqueue, but copies from a caller-owned (reusable) buffer.
+bool net_send(ClientConnection& c, const char* data, size_t len);
+// Queues len bytes of file fd starting at off, sent with sendfile(). owner is released once
+// the range has been sent or the connection closed; it must keep fd and the range valid.
+bool net_send_file(ClientConnection& c, int file_fd, uint64_t off, size_t len, std::shared_ptr<void> owner);
+// Stores resume to be handed out by net_on_writable once at most OUT_LOW_WATER bytes are
+// queued. Returns false, without storing it, if that is already the case or the connection closed.
+bool net_park_until_drained(ClientConnection& c, std::function<void()>&& resume);
+// Releases the owners of sent file ranges the peer has acknowledged. Flushes do this as
+// they go; the event loop calls it now and then for connections that have gone quiet.
+void net_release_sent(ClientConnection& c);
+// Bytes queued for the client and not yet written.
+size_t net_queued_bytes(ClientConnection& c);
+// Shuts the socket down so the event loop closes it; used when a reply cannot be completed.
+void net_abort(ClientConnection& c);
+// Stops or resumes reading requests independently of output back-pressure.
+void net_set_input_paused(ClientConnection& c, bool paused);
+// Called by the event loop when the socket becomes writable. If the queue drained below
+// OUT_LOW_WATER and a request was parked, it is moved to resume for the caller to run.
+bool net_on_writable(ClientConnection& c, std::function<void()>& resume);
@@ -2,16 +2,70 @@
 import curses
 import socket
 import json
+import os
 import textwrap
+import time
 SERVER_HOST = "localhost"
 SERVER_PORT = 8080
+SERVER_UNIX_SOCKET = "compiled/ofs.sock"
 RECV_BUF = 16384
+UPLOAD_CHUNK = 256 * 1024
 
 class OFSClient:
-    def __init__(self, host=SERVER_HOST, port=SERVER_PORT):
-        self.sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
-        self.sock.connect((host, port))
-    
+    def __init__(self, host=SERVER_HOST, port=SERVER_PORT, unix_path=None):
+        if unix_path:
+            self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            self.sock.connect(unix_path)
+        else:
+            self.sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+            self.sock.connect((host, port))
+        self.next_id = 1
+        self.rbuf = b""
+        self.responses = {}
+        self.events = []   # watch events received while waiting for replies
+
+    def _read_line(self):
+        while b"\n" not in self.rbuf:
+            chunk = self.sock.recv(RECV_BUF)
+            if not chunk:
+                raise ConnectionError("connection closed by server")
+            self.rbuf += chunk
+        line, self.rbuf = self.rbuf.split(b"\n", 1)
+        return line.decode(errors="replace")
+
+    def _read_exact(self, n):
+        while len(self.rbuf) < n:
+            chunk = self.sock.recv(RECV_BUF)
+            if not chunk:
+                raise ConnectionError("connection closed by server")
+            self.rbuf += chunk
+        data, self.rbuf = self.rbuf[:n], self.rbuf[n:]
+        return data
+
+    def submit(self, cmd):
+        """Send a command tagged with a fresh request id without waiting for its reply."""
+        rid = str(self.next_id)
+        self.next_id += 1
+        self.sock.sendall(f"#{rid} {cmd}\n".encode())
+        return rid
+
+    def wait(self, rid):
+        """Return the reply for request `rid`, buffering replies to other requests."""
+        while rid not in self.responses:
+            line = self._read_line()
+            try:
+                resp = json.loads(line)
+            except Exception:
+                resp = {"status": "success", "data": line, "request_id": rid}
+            if resp.get("status") == "event":
+                self.events.append(resp["data"])
+                continue
+            if resp.get("operation") == "download" and resp.get("status") == "success":
+                # The file body follows the header line as raw bytes.
+                resp["content"] = self._read_exact(int(resp["data"]["size"]))
+            self.responses[str(resp.get("request_id", rid))] = resp
+        return self.responses.pop(rid)
+
     def send_command(self, cmd):
         """
         Send a single-line command and return a dict:
@@ -20,16 +74,37 @@ class OFSClient:
          - On network error -> {"status":"error","error_message": ...}
         """
         try:
-           
-            self.sock.sendall((cmd + "\n").encode())
-            resp = self.sock.recv(RECV_BUF).decode(errors="replace")
-           
-            try:
-                return json.loads(resp)
-            except Exception:
-                return {"status": "success", "data": resp}
+            return self.wait(self.submit(cmd))
         except Exception as e:
             return {"status": "error", "error_message": str(e)}
+
+    def upload(self, path, data, chunk_size=UPLOAD_CHUNK):
+        """Stream `data` (bytes) into a new file with upload_begin/upload_chunk/upload_commit.
+        Chunks are pipelined; returns the first error reply, or the commit reply."""
+        try:
+            ids = [self.submit(f"upload_begin {path}")]
+            for off in range(0, len(data), chunk_size):
+                piece = data[off:off + chunk_size]
+                rid = str(self.next_id)
+                self.next_id += 1
+                self.sock.sendall(f"#{rid} upload_chunk {len(piece)}\n".encode() + piece)
+                ids.append(rid)
+            ids.append(self.submit("upload_commit"))
+            replies = [self.wait(rid) for rid in ids]
+        except Exception as e:
+            return {"status": "error", "error_message": str(e)}
+        for r in replies:
+            if r.get("status") != "success":
+                return r
+        return replies[-1]
+
+    def send_pipelined(self, cmds):
+        """Send all commands back to back, then collect their replies in order."""
+        try:
+            ids = [self.submit(c) for c in cmds]
+            return [self.wait(rid) for rid in ids]
+        except Exception as e:
+            return [{"status": "error", "error_message": str(e)} for _ in cmds]
     
     def close(self):
         try:
@@ -86,6 +161,36 @@ def normalize_path(path):
         path = path.replace("//", "/")
     return path
 
+TIME_FIELDS = ("created", "modified", "login_time", "last_activity")
+
+def format_time(ts):
+    if not ts:
+        return "0"
+    return time.strftime("%Y-%m-%d %H:%M:%S", time.localtime(ts))
+
+def format_entry(entry):
+    if "username" in entry:
+        return entry["username"] + (" (admin)" if entry.get("role") == "admin" else "")
+    name = entry.get("name", "")
+    if entry.get("type") == "directory":
+        name += "/"
+    return f"{name}  \t{entry.get('size', 0)} bytes \towner:{entry.get('owner', '')} \tperm:{entry.get('permissions', 0)}"
+
+def format_data(data):
+    """Render the structured `data` field of a server response as display text."""
+    if isinstance(data, list):
+        return "\n".join(format_entry(e) if isinstance(e, dict) else str(e) for e in data)
+    if isinstance(data, dict):
+        lines = []
+        for key, value in data.items():
+            if key in TIME_FIELDS:
+                value = format_time(value)
+            lines.append(f"{key.replace('_', ' ').capitalize()}: {value}")
+        return "\n".join(lines)
+    if isinstance(data, str):
+        return data.replace("\\n", "\n")
+    return str(data)
+
 class Button:
     def __init__(self, y, x, label, color_pair=1):
         self.y = y
@@ -381,9 +486,7 @@ def list_files_flow(stdscr, client):
     dir_name = normalize_path(input_box(stdscr, "Directory name:"))
     resp = client.send_command(f"dir_list {dir_name}")
     if isinstance(resp, dict) and resp.get("status") == "success":
-        data = resp.get("data", "")
-        if isinstance(data, str):
-            data = data.replace("\\n", "\n")
+        data = format_data(resp.get("data", []))
         message_box(stdscr, f"Files in {dir_name}", data or "No files")
     else:
         message_box(stdscr, "Error", resp.get("error_message", "Failed to list files"))
@@ -394,10 +497,8 @@ def create_file_flow(stdscr, client):
     path = f"{dir_name}/{file_name}"
     content = edit_file_screen(stdscr, client, path, "")
     if content is not None:
-       
-        escaped_content = content.replace('\\', '\\\\').replace('"', '\\"')
-        cmd = f'create_file {path} "{escaped_content}"'
-        resp = client.send_command(cmd)
+
+        resp = client.upload(path, content.encode())
         if isinstance(resp, dict):
             if resp.get("status") == "success":
                 message_box(stdscr, "Success", f"File created: {path}")
@@ -554,10 +655,7 @@ def file_menu(stdscr, client, username):
         if isinstance(resp, dict):
             if resp.get("status") == "success":
                 if "data" in resp and resp["data"] not in [None, ""]:
-                    data = resp["data"]
-                    if isinstance(data, str):
-                        data = data.replace("\\n", "\n")
-                    message_box(stdscr, choice, data)
+                    message_box(stdscr, choice, format_data(resp["data"]))
                 else:
                     message_box(stdscr, choice, resp.get("error_message", "Success"))
             else:
@@ -575,7 +673,11 @@ def main(stdscr):
     curses.init_pair(4, curses.COLOR_MAGENTA, curses.COLOR_BLACK) # Fancy
     client = None
     try:
-        client = OFSClient()
+        # Same-host servers also listen on a Unix socket, which skips the TCP stack.
+        try:
+            client = OFSClient(unix_path=SERVER_UNIX_SOCKET) if os.path.exists(SERVER_UNIX_SOCKET) else OFSClient()
+        except OSError:
+            client = OFSClient()
     except Exception as e:
         stdscr.clear()
         stdscr.addstr(2,2, f"Failed to connect to server {SERVER_HOST}:{SERVER_PORT} - {e}")